@@ -0,0 +1,72 @@
+#include "arena.h"
+#include <cstdlib>
+
+static const size_t block_size = 64 * 1024;
+
+Arena::Arena() : block(0), pos(NULL), end(NULL)
+{
+	Block b;
+	b.data = (char *)malloc(block_size);
+	b.size = block_size;
+	blocks.push_back(b);
+
+	pos = b.data;
+	end = b.data + b.size;
+}
+
+Arena::~Arena()
+{
+	for(size_t i = 0; i < blocks.size(); i++)
+		free(blocks[i].data);
+}
+
+void *Arena::Allocate(size_t size)
+{
+	// keep everything pointer aligned
+	size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	while(pos + size > end)
+		NextBlock(size);
+
+	void *p = pos;
+	pos += size;
+	return p;
+}
+
+void Arena::NextBlock(size_t size)
+{
+	// blocks are kept after a release and reused
+	block++;
+	if(block == blocks.size())
+	{
+		Block b;
+		b.size = size > block_size ? size : block_size;
+		b.data = (char *)malloc(b.size);
+		blocks.push_back(b);
+	}
+
+	pos = blocks[block].data;
+	end = pos + blocks[block].size;
+}
+
+Arena::Mark Arena::GetMark()
+{
+	Mark mark;
+	mark.block = block;
+	mark.pos = pos;
+	return mark;
+}
+
+void Arena::Release(const Mark &mark)
+{
+	block = mark.block;
+	pos = mark.pos;
+	end = blocks[block].data + blocks[block].size;
+}
+
+size_t Arena::GetCapacity()
+{
+	size_t size = 0;
+	for(size_t i = 0; i < blocks.size(); i++)
+		size += blocks[i].size;
+	return size;
+}
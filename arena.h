@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// bump allocator for objects that die with the definition being compiled
+class Arena
+{
+	struct Block
+	{
+		char *data;
+		size_t size;
+	};
+	std::vector<Block> blocks;
+	size_t block;
+	char *pos;
+	char *end;
+public:
+	struct Mark
+	{
+		size_t block;
+		char *pos;
+	};
+
+	Arena();
+	~Arena();
+
+	void *Allocate(size_t size);
+	Mark GetMark();
+	void Release(const Mark &mark);
+	size_t GetCapacity();
+private:
+	void NextBlock(size_t size);
+};
+
+inline void *operator new(size_t size, Arena &arena)
+{
+	return arena.Allocate(size);
+}
+
+inline void operator delete(void *, Arena &)
+{
+}
@@ -0,0 +1,15 @@
+#!/bin/sh
+# extern calls into a shared object against the same helpers linked as
+# bitcode with -b, where they are inlined into the loop
+
+LLFORTH=${LLFORTH:-./llforth}
+LLVMGCC=${LLVMGCC:-llvm-gcc}
+
+cc -O2 -shared -fPIC bench/helpers.c -o /tmp/llforth-helpers.so
+$LLVMGCC -O2 -c -emit-llvm bench/helpers.c -o /tmp/llforth-helpers.bc
+
+(echo "library /tmp/llforth-helpers.so"; cat bench/bitcode.llfs) > /tmp/llforth-bitcode.llfs
+echo "shared object: $($LLFORTH -O2 -i /tmp/llforth-bitcode.llfs)us"
+echo "bitcode: $($LLFORTH -O2 -b /tmp/llforth-helpers.bc -i bench/bitcode.llfs)us"
+
+rm -f /tmp/llforth-helpers.so /tmp/llforth-helpers.bc /tmp/llforth-bitcode.llfs
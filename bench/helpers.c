@@ -0,0 +1,11 @@
+/* small c helpers for bench/bitcode.sh */
+
+int clamp(int x, int lo, int hi)
+{
+	return x < lo ? lo : x > hi ? hi : x;
+}
+
+long mix(long h, long x)
+{
+	return (h ^ x) * 1099511628211L;
+}
@@ -0,0 +1,26 @@
+#!/bin/sh
+# eager against lazy optimization: load N definitions and run one of
+# them. With -L the compile time should stay flat as N grows.
+
+LLFORTH=${LLFORTH:-./llforth}
+N=${1:-20000}
+
+gen()
+{
+	awk -v n=$1 'BEGIN {
+		for(i = 0; i < n; i++)
+			printf ": w%d ( n -- r ) 0 swap 0 ?do i %d * + loop ;\n", i, i
+		print "1000 w0 ."
+	}' > $2
+}
+
+for n in $N $((N * 2)); do
+	gen $n /tmp/llforth-lazy-$n.llfs
+	for mode in "" -L; do
+		start=$(date +%s.%N)
+		$LLFORTH -O2 $mode -i /tmp/llforth-lazy-$n.llfs > /dev/null
+		end=$(date +%s.%N)
+		echo "$n definitions -O2 $mode: $(echo "$end - $start" | bc)s"
+	done
+	rm -f /tmp/llforth-lazy-$n.llfs
+done
@@ -0,0 +1,71 @@
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <sys/time.h>
+#include "lexer.h"
+
+// lexer throughput: istream extraction against the mapped lexer
+
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void report(const char *name, size_t tokens, size_t bytes, double seconds)
+{
+	std::cout << name << ": " << tokens << " tokens in " << seconds << "s, "
+		<< tokens / seconds / 1e6 << " Mtokens/s, "
+		<< bytes / seconds / (1024 * 1024) << " MB/s" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	if(argc < 2)
+	{
+		std::cerr << "lexer_bench filename [repeat]" << std::endl;
+		return 1;
+	}
+
+	std::string filename(argv[1]);
+	int repeat = argc > 2 ? atoi(argv[2]) : 5;
+
+	// file size
+	std::ifstream size_in(filename.c_str(), std::ios::binary | std::ios::ate);
+	size_t bytes = (size_t)size_in.tellg() * repeat;
+
+	// stream path
+	size_t tokens = 0;
+	double start = now();
+	for(int i = 0; i < repeat; i++)
+	{
+		std::ifstream in(filename.c_str());
+		std::string word;
+		while(in >> word)
+			tokens++;
+	}
+	report("istream", tokens, bytes, now() - start);
+
+	// mapped path
+	tokens = 0;
+	start = now();
+	for(int i = 0; i < repeat; i++)
+	{
+		Lexer lexer(filename);
+		try
+		{
+			while(true)
+			{
+				lexer.NextWord();
+				tokens++;
+			}
+		}
+		catch(EndOfStream &eof)
+		{
+		}
+	}
+	report("mapped", tokens, bytes, now() - start);
+
+	return 0;
+}
@@ -0,0 +1,42 @@
+#!/bin/sh
+# compiler memory: compile N and 2N definitions and compare the max
+# resident size and the compiler arena reported by -v. The arena must
+# not grow with N. Finished words keep only their machine code, so the
+# resident size may grow by SLACK_KB at most, whatever N is. Exits 1 on a
+# regression.
+
+LLFORTH=${LLFORTH:-./llforth}
+N=${1:-100000}
+SLACK_KB=${SLACK_KB:-65536}
+
+gen()
+{
+	awk -v n=$1 'BEGIN { for(i = 0; i < n; i++) printf ": w%d ( a b -- c ) over over + swap drop %d * ;\n", i, i }' > $2
+}
+
+# prints "<resident KB> <arena KB>"
+measure()
+{
+	gen $1 /tmp/llforth-memory-$1.llfs
+	$LLFORTH -v -i /tmp/llforth-memory-$1.llfs 2>&1 >/dev/null | awk '/^memory:/ { sub("KB", "", $2); sub("KB", "", $5); print $2, $5 }'
+	rm -f /tmp/llforth-memory-$1.llfs
+}
+
+set -- $(measure $N) $(measure $((N * 2)))
+if [ $# -ne 4 ]; then
+	echo "no memory line from $LLFORTH -v"
+	exit 1
+fi
+echo "$N definitions: $1KB max resident, $2KB compiler arena"
+echo "$((N * 2)) definitions: $3KB max resident, $4KB compiler arena"
+
+status=0
+if [ $4 -gt $2 ]; then
+	echo "compiler arena grew with the number of definitions"
+	status=1
+fi
+if [ $(($3 - $1)) -gt $SLACK_KB ]; then
+	echo "resident size grew more than ${SLACK_KB}KB"
+	status=1
+fi
+exit $status
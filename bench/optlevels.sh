@@ -0,0 +1,15 @@
+#!/bin/sh
+# compile time against run time at each optimize level. Compile time is
+# the llvm time reported by -v for the words of the benchmark, run time
+# is the sum of the kernel times the benchmark prints.
+
+LLFORTH=${LLFORTH:-./llforth}
+INPUT=${1:-bench/kernels.llfs}
+
+for level in 0 1 2 3; do
+	out=$($LLFORTH -v -O$level -i $INPUT 2>/tmp/llforth-optlevels.err)
+	compile=$(grep "^llvm:" /tmp/llforth-optlevels.err | awk '{ print $5 }')
+	run=$(echo "$out" | awk '{ for(i = 1; i <= NF; i++) t += $i } END { print t / 1e6 "s" }')
+	echo "-O$level: compile $compile, run $run"
+done
+rm -f /tmp/llforth-optlevels.err
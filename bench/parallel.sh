@@ -0,0 +1,20 @@
+#!/bin/sh
+# parallel native output: compile N definitions to an object file with
+# -j 1, 2, 4 and 8. The time should drop with the number of workers, up
+# to the number of cores, as the workers do the optimization and codegen.
+
+LLFORTH=${LLFORTH:-./llforth}
+N=${1:-20000}
+
+awk -v n=$N 'BEGIN {
+	for(i = 0; i < n; i++)
+		printf ": w%d ( n -- r ) 0 swap 0 ?do i %d * + dup 3 / + loop ;\n", i, i
+}' > /tmp/llforth-parallel.llfs
+
+for jobs in 1 2 4 8; do
+	start=$(date +%s.%N)
+	$LLFORTH -O2 -j $jobs -i /tmp/llforth-parallel.llfs -f obj -o /tmp/llforth-parallel.o > /dev/null
+	end=$(date +%s.%N)
+	echo "-j $jobs: $(echo "$end - $start" | bc)s"
+done
+rm -f /tmp/llforth-parallel.llfs /tmp/llforth-parallel.o
@@ -0,0 +1,186 @@
+#include "cache.h"
+#include "jit.h"
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Linker.h>
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/stat.h>
+
+Cache::Cache(const std::string &directory) : directory(directory), hits(0), misses(0), stores(0), seed(Seed)
+{
+	mkdir(directory.c_str(), 0777);
+
+	// the build time, and the size, time and inode of the binary rather
+	// than its bytes so startup stays cheap
+	const char build[] = __DATE__ " " __TIME__;
+	seed = Hash(build, sizeof(build), seed);
+	struct stat st;
+	if(stat("/proc/self/exe", &st) == 0)
+	{
+		uint64_t binary[] = { (uint64_t)st.st_size, (uint64_t)st.st_mtime, (uint64_t)st.st_ino };
+		seed = Hash(binary, sizeof(binary), seed);
+	}
+}
+
+void Cache::AddFile(const std::string &filename)
+{
+	std::ifstream in(filename.c_str(), std::ios::binary);
+	char chunk[65536];
+	while(in.read(chunk, sizeof(chunk)) || in.gcount() > 0)
+		seed = Hash(chunk, in.gcount(), seed);
+}
+
+uint64_t Cache::Hash(const void *data, size_t size, uint64_t hash)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+	for(size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+std::string Cache::GetFilename(uint64_t key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bc", (unsigned long long)key);
+	return directory + "/" + name;
+}
+
+uint64_t Cache::GetKey(llvm::Function *function)
+{
+	// built-in and extern words have no source
+	std::map<llvm::Function *, uint64_t>::iterator it = keys.find(function);
+	return it != keys.end() ? it->second : 0;
+}
+
+static std::string GetKeyName(const std::string &callee)
+{
+	return "forth.key." + callee;
+}
+
+static bool CollectCallees(llvm::Value *value, std::set<llvm::Function *> &callees)
+{
+	// variables and strings belong to the module of the run, words that
+	// use them aren't cached
+	if(llvm::isa<llvm::GlobalVariable>(value))
+		return false;
+	if(llvm::Function *function = llvm::dyn_cast<llvm::Function>(value))
+		callees.insert(function);
+	else if(llvm::ConstantExpr *expr = llvm::dyn_cast<llvm::ConstantExpr>(value))
+		for(unsigned i = 0; i < expr->getNumOperands(); i++)
+			if(!CollectCallees(expr->getOperand(i), callees))
+				return false;
+	return true;
+}
+
+llvm::Function *Cache::Load(uint64_t key, const std::string &word)
+{
+	std::string filename = GetFilename(key);
+	std::string error;
+	llvm::MemoryBuffer *buffer = llvm::MemoryBuffer::getFile(filename.c_str(), &error);
+	if(buffer == NULL)
+	{
+		misses++;
+		return NULL;
+	}
+	llvm::Module *part = llvm::ParseBitcodeFile(buffer, &error);
+	delete buffer;
+	if(part == NULL)
+	{
+		misses++;
+		return NULL;
+	}
+
+	// every callee must already be there with the same type and come
+	// from the same source, shadowed words get other names every run
+	llvm::Module *module = JIT::GetSingleton().GetModule();
+	for(llvm::Module::iterator it = part->begin(); it != part->end(); it++)
+	{
+		if(!it->isDeclaration())
+			continue;
+		llvm::Function *callee = module->getFunction(it->getName());
+		llvm::GlobalVariable *stored = part->getGlobalVariable(GetKeyName(it->getName()), true);
+		llvm::ConstantInt *stored_key = stored != NULL ? llvm::dyn_cast<llvm::ConstantInt>(stored->getInitializer()) : NULL;
+		if(callee == NULL || callee->getFunctionType() != it->getFunctionType()
+			|| stored_key == NULL || stored_key->getZExtValue() != GetKey(callee))
+		{
+			delete part;
+			misses++;
+			return NULL;
+		}
+	}
+
+	// the keys stay out of the module
+	while(!part->global_empty())
+		part->global_begin()->eraseFromParent();
+
+	if(llvm::Linker::LinkModules(module, part, &error))
+	{
+		delete part;
+		misses++;
+		return NULL;
+	}
+	delete part;
+
+	// the stored name is free in any module, the word's may be taken
+	llvm::Function *function = module->getFunction("forth.cached");
+	function->setName(word);
+	keys[function] = key;
+	hits++;
+	return function;
+}
+
+void Cache::Store(uint64_t key, llvm::Function *function)
+{
+	std::set<llvm::Function *> callees;
+	for(llvm::Function::iterator block = function->begin(); block != function->end(); block++)
+		for(llvm::BasicBlock::iterator it = block->begin(); it != block->end(); it++)
+			for(unsigned i = 0; i < it->getNumOperands(); i++)
+				if(!CollectCallees(it->getOperand(i), callees))
+					return;
+
+	// the word alone, callees stay declarations bound by name on load
+	llvm::Module part("cache");
+	llvm::DenseMap<const llvm::Value *, llvm::Value *> values;
+	for(std::set<llvm::Function *>::iterator it = callees.begin(); it != callees.end(); it++)
+	{
+		if(*it == function)
+			continue;
+		llvm::Function *callee = llvm::Function::Create((*it)->getFunctionType(), llvm::Function::ExternalLinkage, (*it)->getName(), &part);
+		callee->setCallingConv((*it)->getCallingConv());
+		values[*it] = callee;
+
+		llvm::Constant *callee_key = llvm::ConstantInt::get(llvm::Type::Int64Ty, GetKey(*it));
+		new llvm::GlobalVariable(llvm::Type::Int64Ty, true, llvm::GlobalValue::InternalLinkage, callee_key, GetKeyName((*it)->getName()), &part, false);
+	}
+
+	llvm::Function *copy = llvm::Function::Create(function->getFunctionType(), llvm::Function::ExternalLinkage, "forth.cached", &part);
+	copy->setCallingConv(function->getCallingConv());
+	values[function] = copy;
+	llvm::Function::arg_iterator arg = copy->arg_begin();
+	for(llvm::Function::arg_iterator it = function->arg_begin(); it != function->arg_end(); it++, arg++)
+		values[&*it] = &*arg;
+	std::vector<llvm::ReturnInst *> returns;
+	llvm::CloneFunctionInto(copy, function, values, returns);
+
+	// other processes may load the same key, they only see whole files
+	std::string filename = GetFilename(key);
+	std::ostringstream temporary;
+	temporary << filename << "." << getpid();
+	std::ofstream of(temporary.str().c_str(), std::ios::binary);
+	llvm::WriteBitcodeToFile(&part, of);
+	of.close();
+	if(of.fail() || rename(temporary.str().c_str(), filename.c_str()) != 0)
+	{
+		unlink(temporary.str().c_str());
+		return;
+	}
+	stores++;
+}
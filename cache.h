@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <stdint.h>
+#include <llvm/Function.h>
+
+// optimized colon definitions on disk, one bitcode file per source key
+class Cache
+{
+	std::string directory;
+	size_t hits;
+	size_t misses;
+	size_t stores;
+	uint64_t seed;
+	std::map<llvm::Function *, uint64_t> keys;
+
+	std::string GetFilename(uint64_t key);
+public:
+	Cache(const std::string &directory);
+
+	// fnv-1a, chain the calls to hash several pieces
+	static const uint64_t Seed = 14695981039346656037ULL;
+	static uint64_t Hash(const void *data, size_t size, uint64_t hash);
+
+	// keys start from the hash of the compiler itself, entries of
+	// another build never hit
+	uint64_t GetSeed() { return seed; }
+	void AddFile(const std::string &filename);
+
+	// source key of the word a function belongs to, entries record the
+	// keys of their callees and only link to the same definitions
+	void SetKey(llvm::Function *function, uint64_t key) { keys[function] = key; }
+	uint64_t GetKey(llvm::Function *function);
+
+	llvm::Function *Load(uint64_t key, const std::string &word);
+	void Store(uint64_t key, llvm::Function *function);
+
+	size_t GetHits() { return hits; }
+	size_t GetMisses() { return misses; }
+	size_t GetStores() { return stores; }
+};
@@ -0,0 +1,359 @@
+#include "engine.h"
+#include "jit.h"
+
+// structured control flow, the compile time stack is merged into phi
+// nodes at joins and loop headers so the values stay in registers
+
+static llvm::Value *CreateTest(llvm::Value *flag)
+{
+	llvm::IRBuilder<> *builder = JIT::GetSingleton().GetBuilder();
+	return builder->CreateICmpNE(flag, llvm::Constant::getNullValue(flag->getType()));
+}
+
+Engine::Control &Engine::GetControl(Control::Kind kind, const char *word)
+{
+	if(control.empty() || control.back().kind != kind)
+		throw std::string("unbalanced control structure at ") + word;
+	return control.back();
+}
+
+Engine::Control &Engine::GetLoop(size_t depth, const char *word)
+{
+	// counted loops only, from the innermost
+	for(size_t i = control.size(); i > 0; i--)
+		if(control[i - 1].kind == Control::DO && depth-- == 0)
+			return control[i - 1];
+	throw std::string(word) + " outside do loop";
+}
+
+void Engine::SaveState(std::vector<llvm::Value *> &state)
+{
+	state.resize(compiler_stack.size());
+	for(size_t i = 0; i < compiler_stack.size(); i++)
+		state[i] = compiler_stack[i]->GetOutput();
+}
+
+void Engine::RestoreState(const std::vector<llvm::Value *> &state)
+{
+	compiler_stack.clear();
+	for(size_t i = 0; i < state.size(); i++)
+		PushValue(state[i]);
+}
+
+void Engine::AddExit(Control &c)
+{
+	// the current block leaves the structure with this stack
+	c.exits.push_back(Edge());
+	Edge &edge = c.exits.back();
+	edge.from = JIT::GetSingleton().GetBlock();
+	edge.depth = control.size();
+	SaveState(edge.state);
+}
+
+void Engine::JoinExits(Control &c, const char *word)
+{
+	JIT &jit = JIT::GetSingleton();
+	size_t size = c.exits[0].state.size();
+	for(size_t i = 1; i < c.exits.size(); i++)
+		if(c.exits[i].state.size() != size)
+			throw std::string("unbalanced stack at ") + word;
+
+	// a phi only where the incoming stacks differ
+	jit.SetBlock(c.exit);
+	compiler_stack.clear();
+	for(size_t i = 0; i < size; i++)
+	{
+		llvm::Value *value = c.exits[0].state[i];
+		bool same = true;
+		for(size_t j = 1; j < c.exits.size(); j++)
+			same = same && c.exits[j].state[i] == value;
+
+		if(!same)
+		{
+			for(size_t j = 1; j < c.exits.size(); j++)
+				if(c.exits[j].state[i]->getType() != value->getType())
+					throw std::string("type mismatch at ") + word;
+
+			llvm::PHINode *phi = jit.GetBuilder()->CreatePHI(value->getType());
+			for(size_t j = 0; j < c.exits.size(); j++)
+				phi->addIncoming(c.exits[j].state[i], c.exits[j].from);
+			value = phi;
+		}
+		PushValue(value);
+	}
+}
+
+void Engine::StartLoop(Control &loop)
+{
+	JIT &jit = JIT::GetSingleton();
+	jit.SetBlock(loop.block);
+
+	// any stack value may change in the body
+	for(size_t i = 0; i < compiler_stack.size(); i++)
+	{
+		llvm::Value *value = compiler_stack[i]->GetOutput();
+		llvm::PHINode *phi = jit.GetBuilder()->CreatePHI(value->getType());
+		phi->addIncoming(value, loop.from);
+		loop.state.push_back(phi);
+		compiler_stack[i] = CreateValue(phi);
+	}
+}
+
+void Engine::CloseLoop(Control &loop)
+{
+	if(loop.state.size() != compiler_stack.size())
+		throw std::string("unbalanced stack in loop");
+
+	// backedge values of the header phis
+	llvm::BasicBlock *block = JIT::GetSingleton().GetBlock();
+	for(size_t i = 0; i < loop.state.size(); i++)
+	{
+		llvm::Value *value = compiler_stack[i]->GetOutput();
+		if(value->getType() != loop.state[i]->getType())
+			throw std::string("type mismatch in loop");
+		llvm::cast<llvm::PHINode>(loop.state[i])->addIncoming(value, block);
+	}
+}
+
+llvm::Value *Engine::CarryArgument(llvm::Value *arg)
+{
+	// an argument read inside a structure was below every saved stack,
+	// each enclosing loop carries it through a new header phi
+	std::vector<llvm::Value *> values(control.size() + 1);
+	values[0] = arg;
+	for(size_t i = 0; i < control.size(); i++)
+	{
+		Control &c = control[i];
+		values[i + 1] = values[i];
+		if(c.kind == Control::IF || c.kind == Control::ELSE)
+			continue;
+
+		llvm::PHINode *phi;
+		if(c.block->empty())
+			phi = llvm::PHINode::Create(arg->getType(), "", c.block);
+		else
+			phi = llvm::PHINode::Create(arg->getType(), "", &c.block->front());
+		phi->addIncoming(values[i], c.from);
+		c.state.insert(c.state.begin(), phi);
+		values[i + 1] = phi;
+	}
+
+	// saved stacks see the value of the structure they were saved in
+	for(size_t i = 0; i < control.size(); i++)
+		for(size_t j = 0; j < control[i].exits.size(); j++)
+		{
+			Edge &edge = control[i].exits[j];
+			edge.state.insert(edge.state.begin(), values[edge.depth]);
+		}
+
+	return values.back();
+}
+
+void Engine::If()
+{
+	JIT &jit = JIT::GetSingleton();
+	llvm::Value *test = CreateTest(Pop(jit.GetCellType())->GetOutput());
+
+	Control c;
+	c.kind = Control::IF;
+	c.from = jit.GetBlock();
+	c.block = jit.CreateBlock("if");
+	c.exit = jit.CreateBlock("then");
+	AddExit(c);
+
+	jit.GetBuilder()->CreateCondBr(test, c.block, c.exit);
+	control.push_back(c);
+	jit.SetBlock(c.block);
+}
+
+void Engine::Else()
+{
+	JIT &jit = JIT::GetSingleton();
+	Control &c = GetControl(Control::IF, "else");
+
+	// the false edge goes to the else branch instead of the join
+	std::vector<llvm::Value *> state;
+	state.swap(c.exits[0].state);
+	c.exits.clear();
+	llvm::BasicBlock *block = jit.CreateBlock("else");
+	c.from->getTerminator()->setSuccessor(1, block);
+
+	// the true branch ends at the join
+	AddExit(c);
+	jit.GetBuilder()->CreateBr(c.exit);
+
+	c.kind = Control::ELSE;
+	jit.SetBlock(block);
+	RestoreState(state);
+}
+
+void Engine::Then()
+{
+	JIT &jit = JIT::GetSingleton();
+	if(control.empty() || (control.back().kind != Control::IF && control.back().kind != Control::ELSE))
+		throw std::string("unbalanced control structure at then");
+	Control &c = control.back();
+
+	AddExit(c);
+	jit.GetBuilder()->CreateBr(c.exit);
+	JoinExits(c, "then");
+	control.pop_back();
+}
+
+void Engine::Begin()
+{
+	JIT &jit = JIT::GetSingleton();
+
+	Control c;
+	c.kind = Control::BEGIN;
+	c.from = jit.GetBlock();
+	c.block = jit.CreateBlock("begin");
+	c.exit = NULL;
+	jit.GetBuilder()->CreateBr(c.block);
+	StartLoop(c);
+	control.push_back(c);
+}
+
+void Engine::Until()
+{
+	JIT &jit = JIT::GetSingleton();
+
+	// the flag may still come from an argument carried by this loop
+	GetControl(Control::BEGIN, "until");
+	llvm::Value *test = CreateTest(Pop(jit.GetCellType())->GetOutput());
+	Control &c = control.back();
+	CloseLoop(c);
+
+	c.exit = jit.CreateBlock("until");
+	AddExit(c);
+	jit.GetBuilder()->CreateCondBr(test, c.exit, c.block);
+	JoinExits(c, "until");
+	control.pop_back();
+}
+
+void Engine::While()
+{
+	JIT &jit = JIT::GetSingleton();
+
+	GetControl(Control::BEGIN, "while");
+	llvm::Value *test = CreateTest(Pop(jit.GetCellType())->GetOutput());
+	Control &c = control.back();
+
+	c.kind = Control::WHILE;
+	c.exit = jit.CreateBlock("repeat");
+	AddExit(c);
+
+	llvm::BasicBlock *body = jit.CreateBlock("while");
+	jit.GetBuilder()->CreateCondBr(test, body, c.exit);
+	jit.SetBlock(body);
+}
+
+void Engine::Repeat()
+{
+	JIT &jit = JIT::GetSingleton();
+	Control &c = GetControl(Control::WHILE, "repeat");
+	CloseLoop(c);
+	jit.GetBuilder()->CreateBr(c.block);
+
+	JoinExits(c, "repeat");
+	control.pop_back();
+}
+
+void Engine::StartDo(bool check)
+{
+	JIT &jit = JIT::GetSingleton();
+	llvm::IRBuilder<> *builder = jit.GetBuilder();
+	llvm::Value *start = Pop(jit.GetCellType())->GetOutput();
+	llvm::Value *limit = Pop(jit.GetCellType())->GetOutput();
+
+	Control c;
+	c.kind = Control::DO;
+	c.from = jit.GetBlock();
+	c.block = jit.CreateBlock("do");
+	c.exit = jit.CreateBlock("loop");
+	c.limit = limit;
+
+	// ?do skips the body when the range is empty
+	if(check)
+	{
+		AddExit(c);
+		builder->CreateCondBr(builder->CreateICmpEQ(start, limit), c.exit, c.block);
+	}
+	else
+		builder->CreateBr(c.block);
+
+	// the induction variable is a header phi, the backedge comes at loop
+	StartLoop(c);
+	llvm::PHINode *index = builder->CreatePHI(start->getType());
+	index->addIncoming(start, c.from);
+	c.index = index;
+	control.push_back(c);
+}
+
+void Engine::FinishDo(llvm::Value *next, llvm::Value *test)
+{
+	JIT &jit = JIT::GetSingleton();
+	Control &c = control.back();
+	CloseLoop(c);
+	llvm::cast<llvm::PHINode>(c.index)->addIncoming(next, jit.GetBlock());
+
+	AddExit(c);
+	jit.GetBuilder()->CreateCondBr(test, c.exit, c.block);
+	JoinExits(c, "loop");
+	control.pop_back();
+}
+
+void Engine::Do()
+{
+	StartDo(false);
+}
+
+void Engine::QuestionDo()
+{
+	StartDo(true);
+}
+
+void Engine::Loop()
+{
+	llvm::IRBuilder<> *builder = JIT::GetSingleton().GetBuilder();
+	Control &c = GetControl(Control::DO, "loop");
+
+	llvm::Value *next = builder->CreateAdd(c.index, llvm::ConstantInt::get(c.index->getType(), 1));
+	FinishDo(next, builder->CreateICmpEQ(next, c.limit));
+}
+
+void Engine::PlusLoop()
+{
+	llvm::IRBuilder<> *builder = JIT::GetSingleton().GetBuilder();
+	GetControl(Control::DO, "+loop");
+	llvm::Value *step = Pop(JIT::GetSingleton().GetCellType())->GetOutput();
+	Control &c = control.back();
+
+	// done when the index crosses the boundary between limit-1 and limit
+	llvm::Value *next = builder->CreateAdd(c.index, step);
+	llvm::Value *before = builder->CreateSub(c.index, c.limit);
+	llvm::Value *after = builder->CreateSub(next, c.limit);
+	llvm::Value *crossed = builder->CreateXor(before, after);
+	FinishDo(next, builder->CreateICmpSLT(crossed, llvm::Constant::getNullValue(crossed->getType())));
+}
+
+void Engine::LoopIndex()
+{
+	PushValue(GetLoop(0, "i").index);
+}
+
+void Engine::OuterLoopIndex()
+{
+	PushValue(GetLoop(1, "j").index);
+}
+
+void Engine::LeaveLoop()
+{
+	JIT &jit = JIT::GetSingleton();
+	Control &c = GetLoop(0, "leave");
+	AddExit(c);
+	jit.GetBuilder()->CreateBr(c.exit);
+
+	// the rest of the branch is dead
+	jit.SetBlock(jit.CreateBlock("leave"));
+}
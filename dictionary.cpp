@@ -0,0 +1,95 @@
+#include "dictionary.h"
+#include "word.h"
+
+const char *Wordlist::Add(const std::string &name, Word *word)
+{
+	const char *begin = name.data();
+	llvm::StringMapEntry<Word *> &entry = words.GetOrCreateValue(begin, begin + name.size());
+
+	// shadow the previous definition
+	word->SetLink(entry.getValue());
+	entry.setValue(word);
+
+	return entry.getKeyData();
+}
+
+Word *Wordlist::Find(const Token &token)
+{
+	llvm::StringMap<Word *>::iterator it = words.find(token.GetData(), token.GetEnd());
+	if(it == words.end())
+		return NULL;
+
+	Word *word = it->getValue();
+	while(word != NULL && word->IsHidden())
+		word = word->GetLink();
+
+	return word;
+}
+
+Dictionary::Dictionary()
+{
+	// forth-wordlist
+	current = CreateWordlist();
+	order.push_back(current);
+}
+
+Dictionary::~Dictionary()
+{
+	for(size_t i = 0; i < wordlists.size(); i++)
+		delete wordlists[i];
+}
+
+size_t Dictionary::CreateWordlist()
+{
+	wordlists.push_back(new Wordlist());
+	return wordlists.size() - 1;
+}
+
+Wordlist *Dictionary::GetWordlist(size_t wid)
+{
+	if(wid >= wordlists.size())
+		throw std::string("invalid wordlist");
+	return wordlists[wid];
+}
+
+void Dictionary::SetCurrent(size_t wid)
+{
+	GetWordlist(wid);
+	current = wid;
+}
+
+void Dictionary::PushOrder(size_t wid)
+{
+	GetWordlist(wid);
+	order.push_back(wid);
+}
+
+void Dictionary::PopOrder()
+{
+	if(order.size() <= 1)
+		throw std::string("search order underflow");
+	order.pop_back();
+}
+
+void Dictionary::Only()
+{
+	order.clear();
+	order.push_back(0);
+}
+
+const char *Dictionary::Add(const std::string &name, Word *word)
+{
+	return wordlists[current]->Add(name, word);
+}
+
+Word *Dictionary::Find(const Token &token)
+{
+	for(std::vector<size_t>::reverse_iterator it = order.rbegin(); it != order.rend(); it++)
+	{
+		Word *word = wordlists[*it]->Find(token);
+		if(word != NULL)
+			return word;
+	}
+
+	return NULL;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <llvm/ADT/StringMap.h>
+#include "lexer.h"
+
+class Word;
+
+class Wordlist
+{
+	// latest word of every name, older ones chained by Word::GetLink
+	llvm::StringMap<Word *> words;
+public:
+	const char *Add(const std::string &name, Word *word);
+	Word *Find(const Token &token);
+	size_t GetSize() { return words.size(); }
+};
+
+class Dictionary
+{
+	std::vector<Wordlist *> wordlists;
+	std::vector<size_t> order;
+	size_t current;
+public:
+	Dictionary();
+	~Dictionary();
+
+	size_t CreateWordlist();
+	Wordlist *GetWordlist(size_t wid);
+
+	size_t GetCurrent() { return current; }
+	void SetCurrent(size_t wid);
+
+	// search order, the last wordlist is searched first
+	void PushOrder(size_t wid);
+	void PopOrder();
+	void Also() { PushOrder(order.back()); }
+	void Only();
+	void Definitions() { current = order.back(); }
+
+	const char *Add(const std::string &name, Word *word);
+	Word *Find(const Token &token);
+};
@@ -1,26 +1,68 @@
 #include "engine.h"
 #include "words.h"
 #include "jit.h"
+#include "vector.h"
+#include "runtime.h"
 #include <sstream>
+#include <algorithm>
+#include <cstdlib>
+#include <sys/time.h>
+#include <sys/resource.h>
 
 #include "words.inc"
 
-Engine::Engine()
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+Engine::Engine() : runtime_stack(65536)
 {
 	verbose = false;
+	batch = false;
+	batching = false;
 	latest = NULL;
-	lexer = new Lexer(std::cin);
+	current = NULL;
+	threshold = 0;
+	threaded_words = 0;
+	promoted_words = 0;
+	compiled_words = 0;
+	compile_time = 0;
+	compile_start = 0;
+	compiling = false;
+	has_effect = false;
+	effect_inputs = 0;
+	effect_outputs = 0;
+	declared = false;
+	lexer = NULL;
+	cache = NULL;
+	release = false;
+	live = false;
+
+	// words_declare.inc runs inside GetSingleton, the jit can't call back
+	JIT::GetSingleton().SetArena(&arena);
 
-#define WORD(name) words.push_back(new name())
+#define WORD(name) AddWord(new name())
 #define BWORD(name) CreateWord(); { std::string _name = name
 #define BUILDER JIT::GetSingleton().GetBuilder()
+#define CELL JIT::GetSingleton().GetCellType()
 #define ARG(number) llvm::Value *arg##number = JIT::GetSingleton().CreateInputArgument()
-#define OUT(number, val) BUILDER->CreateStore(val, JIT::GetSingleton().CreateOutputArgument())
-#define EWORD() BUILDER->CreateRetVoid(); FinishWord(_name); }
-#define IWORD(name, func, inputs, outputs) \
+#define FARG(number) llvm::Value *arg##number = JIT::GetSingleton().CreateInputArgument(llvm::Type::DoubleTy)
+#define OUT(number, val) JIT::GetSingleton().AddOutput(val)
+#define EWORD() FinishWord(_name); }
+#define IWORD(name, func, signature) \
 	JIT::GetSingleton().AddInternalSymbol(name, (void *)&func); \
-	CreateExternWord(name, inputs, outputs);
+	CreateExternWord(name, signature); \
+	latest->SetBatchable(false);
+#define RWORD(name, func, signature) \
+	IWORD(name, func, signature) \
+	JIT::GetSingleton().AddRuntimeSymbol(name, #func);
 #define IMMEDIATE() latest->SetImmediate(true)
+#define INLINE() latest->SetInline(true)
+#define SWORD(name, shuffle) AddWord(new ShuffleWord(name, shuffle))
+#define CWORD(name, method) AddWord(new ControlWord(name, &Engine::method))
 
 	#include "words_declare.inc"
 
@@ -28,16 +70,22 @@ Engine::Engine()
 #undef BWORD
 #undef JIT
 #undef BUILDER
+#undef CELL
 #undef ARG
+#undef FARG
 #undef OUT
 #undef EWORD
 #undef IWORD
+#undef RWORD
+#undef SWORD
+#undef CWORD
 #undef INLINE
 }
 
 Engine::~Engine()
 {
 	delete lexer;
+	delete cache;
 }
 
 void Engine::SetInputStream(std::istream &in)
@@ -46,6 +94,13 @@ void Engine::SetInputStream(std::istream &in)
 	lexer = new Lexer(in);
 }
 
+void Engine::SetInputFile(const std::string &filename)
+{
+	delete lexer;
+	lexer = NULL;
+	lexer = new Lexer(filename);
+}
+
 Engine &Engine::GetSingleton()
 {
 	static Engine engine;
@@ -58,25 +113,20 @@ void Engine::MainLoop()
 	{
 		while(true)
 		{
-			std::string word = lexer->NextWord();
-			ExecuteWord(word);
+			Token word = lexer->NextToken();
+			if(batch)
+				BatchWord(word);
+			else
+				ExecuteWord(word);
 		}
 	}
 	catch(EndOfStream &eof)
 	{
+		FlushBatch();
 	}
 }
 
-Word *Engine::FindWord(const std::string &word)
-{
-	for(Words::reverse_iterator it = words.rbegin(); it != words.rend(); it++)
-		if(!(*it)->IsHidden() && (*it)->GetName() == word)
-			return *it;
-
-	return NULL;
-}
-
-void Engine::ExecuteWord(const std::string &word)
+void Engine::ExecuteWord(const Token &word)
 {
 	Word *w = FindWord(word);
 	if(w != NULL)
@@ -86,76 +136,610 @@ void Engine::ExecuteWord(const std::string &word)
 	}
 
 	// integer?
-	std::istringstream is(word);
-	int number;
-	if(is >> number)
+	cell number;
+	if(ParseNumber(word, number))
 	{
 		LiteralWord lit(number);
 		lit.Execute(false);
 		return;
 	}
 
+	// float?
+	double fnumber;
+	if(ParseFloat(word, fnumber))
+	{
+		FloatWord lit(fnumber);
+		lit.Execute(false);
+		return;
+	}
+
 	throw std::string("unknown word");
 }
 
-void Engine::CreateExternWord(const std::string &word, size_t inputs, size_t outputs)
+void Engine::BatchWord(const Token &word)
+{
+	// host and immediate words see the interpreter state
+	Word *w = FindWord(word);
+	if(w != NULL && (w->IsImmediate() || !w->IsBatchable()))
+	{
+		FlushBatch();
+		w->Execute(NULL);
+		return;
+	}
+
+	// compile into the anonymous word of this line
+	if(!batching)
+	{
+		CreateWord();
+		batching = true;
+	}
+	CompileWord(word);
+
+	if(lexer->AtEndOfLine())
+		FlushBatch();
+}
+
+void Engine::FlushBatch()
 {
-	JIT::GetSingleton().CreateExternWord(word, inputs, outputs);
+	if(!batching)
+		return;
+	batching = false;
+
+	CompileOutputs();
+	FunctionWord *word = FinishWord("");
+	word->Execute(NULL);
+
+	JIT::GetSingleton().DeleteFunction(word->GetFunction());
+	delete word;
+}
+
+bool Engine::ParseNumber(const Token &word, cell &number)
+{
+	std::istringstream is(word);
+	return (is >> number) && is.eof();
+}
+
+bool Engine::ParseFloat(const Token &word, double &number)
+{
+	// 1.5 or 15e-1, a bare 1e means 1e0
+	std::string str = word;
+	if(str.find_first_of(".eE") == std::string::npos)
+		return false;
+	if(str[str.size() - 1] == 'e' || str[str.size() - 1] == 'E')
+		str += "0";
+
+	std::istringstream is(str);
+	return (is >> number) && is.eof();
+}
+
+void Engine::CreateExternWord(const std::string &word, const std::string &signature)
+{
+	// like the extern comment, i for a cell, f for a double, the c types
+	// are i8 i16 i32 i64, p for a pointer and sf for a float
+	std::vector<const llvm::Type *> inputs;
+	std::vector<const llvm::Type *> outputs;
+	std::vector<const llvm::Type *> *types = &inputs;
+	std::istringstream is(signature);
+	std::string token;
+	while(is >> token)
+	{
+		if(token == "--")
+			types = &outputs;
+		else if(token == "i")
+			types->push_back(JIT::GetSingleton().GetCellType());
+		else if(token == "i8" || token == "i16" || token == "i32" || token == "i64")
+			types->push_back(llvm::IntegerType::get(atoi(token.c_str() + 1)));
+		else if(token == "p")
+			types->push_back(llvm::PointerType::getUnqual(llvm::Type::Int8Ty));
+		else if(token == "f")
+			types->push_back(llvm::Type::DoubleTy);
+		else if(token == "sf")
+			types->push_back(llvm::Type::FloatTy);
+		else
+			throw std::string("unknown type ") + token;
+	}
+	if(types != &outputs)
+		throw std::string("missing -- in ") + word;
+
+	bool wrapped = JIT::GetSingleton().CreateExternWord(word, inputs, outputs);
 
 	latest = new FunctionWord();
 	latest->SetFunction(JIT::GetSingleton().GetLatest());
-	latest->SetInputSize(inputs);
-	latest->SetOutputSize(outputs);
-	words.push_back(latest);
+	latest->SetInline(wrapped);
+	latest->SetInputSize(inputs.size());
+	latest->SetOutputSize(outputs.size());
+	latest->SetName(dictionary.Add(word, latest));
 }
 
 void Engine::CreateWord()
+{
+	FunctionWord *word = new FunctionWord();
+	word->SetHidden(true);
+	CreateWord(word);
+}
+
+void Engine::CreateWord(FunctionWord *word)
 {
 	JIT::GetSingleton().CreateWord();
 
 	compiler_stack.clear();
 	compiler_args.clear();
+	control.clear();
+	compiling = true;
 
-	latest = new FunctionWord();
-	latest->SetHidden(true);
-	words.push_back(latest);
+	current = word;
+	used.clear();
+	arena_mark = arena.GetMark();
+	compile_start = now();
 }
 
-void Engine::FinishWord(const std::string& word)
+void Engine::CompileWord(const Token &token)
 {
-	latest->SetInputSize(JIT::GetSingleton().GetInputSize());
-	latest->SetOutputSize(JIT::GetSingleton().GetOutputSize());
+	Word *word = FindWord(token);
+	if(word == NULL)
+	{
+		// integer or float?
+		cell number;
+		double fnumber;
+		if(ParseNumber(token, number))
+			word = new (arena) LiteralWord(number);
+		else if(ParseFloat(token, fnumber))
+			word = new (arena) FloatWord(fnumber);
+		else
+			throw std::string("unknown word ") + std::string(token);
+	}
+	else if(word->IsImmediate())
+	{
+		// inline
+		word->Execute(NULL);
+		return;
+	}
+
+	CompileInstance(word);
+}
+
+void Engine::CompileInstance(Word *word)
+{
+	// create word instance
+	WordInstance *instance = new (arena) WordInstance(arena, word);
+	instance->Compile();
+
+	Push(instance);
+}
+
+void Engine::CompileOutputs()
+{
+	if(!control.empty())
+		throw std::string("unclosed control structure");
+
+	// declared words pass the arguments they don't use through
+	if(declared)
+		while(compiler_args.size() < effect_inputs)
+			compiler_stack.insert(compiler_stack.begin(), PopArgument(JIT::GetSingleton().GetCellType()));
+
+	// setup outputs, from the bottom of the stack
+	for(size_t i = 0; i < compiler_stack.size(); i++)
+		JIT::GetSingleton().AddOutput(compiler_stack[i]->GetOutput());
+	compiler_stack.clear();
+}
+
+FunctionWord *Engine::FinishWord(const std::string& word)
+{
+	FinishFunction(word);
+
+	// anonymous words stay out of the dictionary, recursive ones are
+	// already there
+	if(word != "")
+	{
+		if(current->GetName().empty())
+			current->SetName(dictionary.Add(word, current));
+		latest = current;
+	}
+
+	return current;
+}
+
+uint64_t Engine::HashDefinition(const std::string &word, bool known, size_t inputs, size_t outputs)
+{
+	// what the code depends on besides the body
+	std::ostringstream settings;
+	settings << word << " " << known << " " << inputs << " " << outputs << " " << sizeof(cell) << " " << JIT::GetSingleton().GetOptimize();
+	std::string prefix = settings.str();
+	uint64_t key = Cache::Hash(prefix.data(), prefix.size(), cache->GetSeed());
+
+	// the body tokens and the keys of the words they use, read ahead
+	const char *position = lexer->GetPosition();
+	while(true)
+	{
+		Token token = lexer->NextToken();
+		if(token == ";")
+			break;
+		key = Cache::Hash(token.GetData(), token.GetSize(), key);
+		key = Cache::Hash(" ", 1, key);
+
+		Word *used = FindWord(token);
+		uint64_t used_key = used != NULL ? used->GetSourceKey() : 0;
+		key = Cache::Hash(&used_key, sizeof(used_key), key);
+	}
+	lexer->SetPosition(position);
+	return key;
+}
+
+bool Engine::LoadDefinition(const std::string &word, uint64_t key)
+{
+	llvm::Function *function = cache->Load(key, word);
+	if(function == NULL)
+		return false;
+
+	// the body was hashed, skip it
+	while(lexer->NextToken() != ";")
+		;
+
+	FunctionWord *w = new FunctionWord();
+	w->SetFunction(function);
+	w->SetInputSize(function->arg_size());
+	const llvm::Type *ret_type = function->getReturnType();
+	if(const llvm::StructType *stype = llvm::dyn_cast<llvm::StructType>(ret_type))
+		w->SetOutputSize(stype->getNumElements());
+	else
+		w->SetOutputSize(ret_type != llvm::Type::VoidTy ? 1 : 0);
+	w->SetSourceKey(key);
+	w->SetName(dictionary.Add(word, w));
+	latest = w;
+	return true;
+}
+
+void Engine::StoreDefinition(uint64_t key)
+{
+	latest->SetSourceKey(key);
+	if(latest->GetFunction() == NULL)
+		return;
+
+	// lazy words are optimized before they are stored
+	cache->SetKey(latest->GetFunction(), key);
+	JIT::GetSingleton().Materialize(latest->GetFunction());
+	cache->Store(key, latest->GetFunction());
+}
+
+void Engine::ReleaseDefinition()
+{
+	if(release && latest->GetFunction() != NULL)
+		JIT::GetSingleton().ReleaseBody(latest->GetFunction());
+}
+
+void Engine::UseWord(FunctionWord *word)
+{
+	if(live)
+		used.push_back(word);
+}
+
+static bool SourceOrder(FunctionWord *a, FunctionWord *b)
+{
+	return a->GetSource() < b->GetSource();
+}
+
+void Engine::Relink(const std::string &word, const char *source)
+{
+	JIT &jit = JIT::GetSingleton();
+	FunctionWord *w = latest;
+	FunctionWord *old = live_words.count(word) ? live_words[word] : NULL;
+	bool extends = false;
+	w->SetSource(source);
+	for(size_t i = 0; i < used.size(); i++)
+	{
+		used[i]->AddUser(w);
+		extends = extends || used[i] == old;
+	}
+	used.clear();
+
+	// a word that calls the one it redefines, : foo foo 1 + ; would call
+	// itself through the old slot, its callers keep the old word
+	live_words[word] = w;
+	if(old == NULL || extends)
+	{
+		w->SetSlot(jit.CreateSlot(w->GetFunction()));
+		return;
+	}
+
+	// same stack effect, callers keep calling through the old slot
+	if(old->GetFunction()->getFunctionType() == w->GetFunction()->getFunctionType())
+	{
+		w->SetSlot(old->GetSlot());
+		w->GetUsers() = old->GetUsers();
+		jit.PatchSlot(w->GetSlot(), w->GetFunction());
+		if(verbose)
+			std::cerr << "RELINK: " << word << ", " << w->GetUsers().size() << " callers" << std::endl;
+		return;
+	}
+
+	// callers were compiled for the old stack effect, recompile them from
+	// their source, in order, their own redefinitions take it further
+	w->SetSlot(jit.CreateSlot(w->GetFunction()));
+	std::vector<FunctionWord *> users(old->GetUsers());
+	std::sort(users.begin(), users.end(), SourceOrder);
+	llvm::Function *function = jit.GetLatest();
+	for(size_t i = 0; i < users.size(); i++)
+	{
+		// skip callers redefined since, or by an earlier recompile
+		FunctionWord *user = users[i];
+		if(live_words[user->GetName()] != user)
+			continue;
+		if(verbose)
+			std::cerr << "RECOMPILE: " << user->GetName() << " for " << word << std::endl;
+
+		const char *position = lexer->GetPosition();
+		lexer->SetPosition(user->GetSource());
+		word_colon();
+		lexer->SetPosition(position);
+	}
+
+	// immediate and friends apply to the word just defined
+	latest = w;
+	jit.SetLatest(function);
+}
+
+void Engine::FinishFunction(const std::string &word)
+{
+	current->SetInputSize(JIT::GetSingleton().GetInputSize());
+	current->SetOutputSize(JIT::GetSingleton().GetOutputSize());
 
 	JIT::GetSingleton().FinishWord(word);
-	latest->SetFunction(JIT::GetSingleton().GetLatest());
-	latest->SetHidden(false);
+	current->SetFunction(JIT::GetSingleton().GetLatest());
+	current->SetHidden(false);
+
+	// promoted threaded words got their key before they had a function
+	if(cache != NULL && current->GetSourceKey() != 0)
+		cache->SetKey(current->GetFunction(), current->GetSourceKey());
+	compiling = false;
+	has_effect = false;
+	declared = false;
+
+	// drop everything allocated for this definition
+	arena.Release(arena_mark);
+
+	compiled_words++;
+	compile_time += now() - compile_start;
+}
+
+bool Engine::ThreadWord(ThreadedCode *code, const Token &token)
+{
+	Word *word = FindWord(token);
+	if(word == NULL)
+	{
+		// integer?
+		cell number;
+		if(!ParseNumber(token, number))
+			return false;
+		code->AddLiteral(number);
+		return true;
+	}
+
+	size_t inputs, outputs;
+	if(word->IsImmediate() || !word->GetStackEffect(inputs, outputs))
+		return false;
+
+	code->AddCall(word, inputs, outputs);
+	return true;
+}
+
+void Engine::Replay(ThreadedCode *code)
+{
+	for(size_t i = 0; i < code->GetSize(); i++)
+		switch(code->GetKind(i))
+		{
+		case ThreadedCode::LITERAL:
+			CompileInstance(new (arena) LiteralWord(code->GetLiteral(i)));
+			break;
+		case ThreadedCode::CALL:
+			CompileInstance(code->GetWord(i));
+			break;
+		case ThreadedCode::EXIT:
+			break;
+		}
+}
+
+FunctionWord *Engine::FinishThreadedWord(const std::string &word, ThreadedCode *code)
+{
+	code->Finish();
+
+	FunctionWord *w = new FunctionWord();
+	w->SetThreaded(code);
+	w->SetInputSize(code->GetInputSize());
+	w->SetOutputSize(code->GetOutputSize());
+	w->SetName(dictionary.Add(word, w));
+	latest = w;
+
+	threaded_words++;
+	return w;
+}
+
+void Engine::Promote(FunctionWord *word)
+{
+	ThreadedCode *code = word->GetThreaded();
+
+	// may be in the middle of another definition
+	SuspendWord();
+	CreateWord(word);
+	Replay(code);
+	CompileOutputs();
+	FinishFunction(word->GetName());
+	ResumeWord();
+
+	word->SetThreaded(NULL);
+	delete code;
+	promoted_words++;
+
+	if(verbose)
+		std::cerr << "PROMOTE: " << word->GetName() << std::endl;
+}
+
+void Engine::SuspendWord()
+{
+	JIT::GetSingleton().SuspendWord();
+
+	suspended.push_back(Definition());
+	Definition &d = suspended.back();
+	d.current = current;
+	d.compiler_stack.swap(compiler_stack);
+	d.compiler_args.swap(compiler_args);
+	d.control.swap(control);
+	d.compiling = compiling;
+	d.defining = defining;
+	d.has_effect = has_effect;
+	d.effect_inputs = effect_inputs;
+	d.effect_outputs = effect_outputs;
+	d.declared = declared;
+	d.arena_mark = arena_mark;
+	d.compile_start = compile_start;
+	d.used.swap(used);
+}
+
+void Engine::ResumeWord()
+{
+	Definition &d = suspended.back();
+	current = d.current;
+	compiler_stack.swap(d.compiler_stack);
+	compiler_args.swap(d.compiler_args);
+	control.swap(d.control);
+	compiling = d.compiling;
+	defining = d.defining;
+	has_effect = d.has_effect;
+	effect_inputs = d.effect_inputs;
+	effect_outputs = d.effect_outputs;
+	declared = d.declared;
+	arena_mark = d.arena_mark;
+	compile_start = d.compile_start;
+	used.swap(d.used);
+	suspended.pop_back();
+
+	JIT::GetSingleton().ResumeWord();
+}
+
+void Engine::SetStackEffect(const std::string &word, bool known, size_t inputs, size_t outputs)
+{
+	defining = word;
+	has_effect = known;
+	effect_inputs = inputs;
+	effect_outputs = outputs;
+}
+
+void Engine::DeclareCurrent(const char *word)
+{
+	if(declared)
+		return;
+	if(!has_effect)
+		throw std::string(word) + " needs a stack effect comment";
+
+	// calls to the word being defined go to the final function
+	JIT::GetSingleton().DeclareWord(defining, effect_inputs, effect_outputs);
+	current->SetFunction(JIT::GetSingleton().GetLatest());
+	current->SetInputSize(effect_inputs);
+	current->SetOutputSize(effect_outputs);
+	declared = true;
+}
+
+void Engine::Recurse()
+{
+	DeclareCurrent("recurse");
+	CompileInstance(current);
+}
+
+void Engine::Recursive()
+{
+	// the name finds the definition from here on
+	DeclareCurrent("recursive");
+	current->SetName(dictionary.Add(defining, current));
+	current->SetHidden(false);
+}
+
+void Engine::PrintStatistics()
+{
+	double average = compiled_words != 0 ? compile_time / compiled_words : 0;
+	size_t cold_words = threaded_words - promoted_words;
+
+	std::cerr << "llvm: " << compiled_words << " words in " << compile_time << "s at -O" << JIT::GetSingleton().GetOptimize() << std::endl;
+	std::cerr << "threaded: " << threaded_words << " words, " << promoted_words << " promoted" << std::endl;
+	std::cerr << "saved: ~" << cold_words * average << "s on " << cold_words << " cold words" << std::endl;
+	std::cerr << "lazy: " << JIT::GetSingleton().GetPendingSize() << " words never optimized" << std::endl;
+	if(cache != NULL)
+		std::cerr << "cache: " << cache->GetHits() << " hits, " << cache->GetMisses() << " misses, " << cache->GetStores() << " stored" << std::endl;
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	std::cerr << "memory: " << usage.ru_maxrss << "KB max resident, " << arena.GetCapacity() / 1024 << "KB compiler arena" << std::endl;
 }
 
 void Engine::Push(WordInstance *instance)
 {
-	// setup outputs
+	// setup outputs, the last one is the top of stack
 	for(size_t i = 0; i < instance->GetOutputSize(); i++)
-		compiler_stack.push_front(new WordIndex(instance, i));
+		compiler_stack.push_back(new (arena) WordIndex(instance, i));
+}
+
+void Engine::PushValue(llvm::Value *value)
+{
+	compiler_stack.push_back(CreateValue(value));
+}
+
+WordIndex *Engine::CreateValue(llvm::Value *value)
+{
+	WordInstance *instance = new (arena) WordInstance(arena, new (arena) ValueWord(value));
+	instance->Compile();
+	return new (arena) WordIndex(instance, 0);
 }
 
 WordIndex *Engine::Pop()
 {
-	WordIndex *value;
+	// untyped arguments are cells until something else uses them
+	return Pop(NULL);
+}
+
+WordIndex *Engine::Pop(const llvm::Type *type)
+{
 	if(compiler_stack.size() == 0)
+		return PopArgument(type != NULL ? type : JIT::GetSingleton().GetCellType());
+
+	// drop value from stack
+	WordIndex *value = compiler_stack.back();
+	compiler_stack.pop_back();
+	if(type == NULL || value->GetOutput()->getType() == type)
+		return value;
+
+	// an argument moved by shuffles takes the type of its first use
+	llvm::Value *from = value->GetOutput();
+	llvm::Value *to = JIT::GetSingleton().RetypeArgument(from, type);
+	if(to == NULL)
+		throw std::string("type mismatch");
+	ReplaceValue(from, to);
+	return CreateValue(to);
+}
+
+void Engine::ReplaceValue(llvm::Value *from, llvm::Value *to)
+{
+	for(size_t i = 0; i < compiler_stack.size(); i++)
+		if(compiler_stack[i]->GetOutput() == from)
+			compiler_stack[i] = CreateValue(to);
+
+	for(size_t i = 0; i < control.size(); i++)
 	{
-		// drop value from function argument
-		ArgumentWord *arg = new ArgumentWord(compiler_args.size());
-		WordInstance *arg_instance = new WordInstance(arg);
-		compiler_args.push_back(arg);
-		arg_instance->Compile();
-		value = new WordIndex(arg_instance, 0);
-	}
-	else
-	{
-		// drop value from stack
-		value = compiler_stack.back();
-		compiler_stack.pop_back();
+		std::replace(control[i].state.begin(), control[i].state.end(), from, to);
+		for(size_t j = 0; j < control[i].exits.size(); j++)
+			std::replace(control[i].exits[j].state.begin(), control[i].exits[j].state.end(), from, to);
 	}
+}
+
+WordIndex *Engine::PopArgument(const llvm::Type *type)
+{
+	// drop value from function argument
+	ArgumentWord *arg = new (arena) ArgumentWord(compiler_args.size(), type);
+	WordInstance *arg_instance = new (arena) WordInstance(arena, arg);
+	compiler_args.push_back(arg);
+	arg_instance->Compile();
+	WordIndex *value = new (arena) WordIndex(arg_instance, 0);
+
+	// open control structures need it too
+	if(!control.empty())
+		value = CreateValue(CarryArgument(value->GetOutput()));
 
 	return value;
 }
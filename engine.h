@@ -1,43 +1,197 @@
 #pragma once
 
-#include <list>
+#include <vector>
+#include <map>
 #include "lexer.h"
+#include "arena.h"
+#include "stack.h"
+#include "dictionary.h"
 #include "words.h"
+#include "cache.h"
 
 class Engine
 {
 	bool verbose;
+	bool batch;
+	bool batching;
 
 	Lexer *lexer;
+	Cache *cache;
+	bool release;
 
-	typedef std::list<Word *> Words;
-	Words words;
+	// live mode, latest definition of every name and the live words the
+	// current definition calls
+	bool live;
+	std::map<std::string, FunctionWord *> live_words;
+	std::vector<FunctionWord *> used;
+
+	Dictionary dictionary;
 	FunctionWord *latest;
+	FunctionWord *current;
+
+	// per definition compiler state
+	Arena arena;
+	Arena::Mark arena_mark;
+
+	// tiers
+	unsigned threshold;
+	size_t threaded_words;
+	size_t promoted_words;
+	size_t compiled_words;
+	double compile_time;
+	double compile_start;
+
+	// open control structures of the current definition
+	struct Edge
+	{
+		llvm::BasicBlock *from;
+		size_t depth;
+		std::vector<llvm::Value *> state;
+	};
+	struct Control
+	{
+		enum Kind { IF, ELSE, BEGIN, WHILE, DO };
+		Kind kind;
+		llvm::BasicBlock *block;
+		llvm::BasicBlock *from;
+		llvm::BasicBlock *exit;
+		llvm::Value *index;
+		llvm::Value *limit;
+		std::vector<llvm::Value *> state;
+		std::vector<Edge> exits;
+	};
+	std::vector<Control> control;
+	bool compiling;
+
+	// stack effect comment of the colon definition, recurse needs the
+	// function before the body is compiled
+	std::string defining;
+	bool has_effect;
+	size_t effect_inputs;
+	size_t effect_outputs;
+	bool declared;
+
+	struct Definition
+	{
+		FunctionWord *current;
+		std::vector<WordIndex *> compiler_stack;
+		std::vector<ArgumentWord *> compiler_args;
+		std::vector<Control> control;
+		bool compiling;
+		std::string defining;
+		bool has_effect;
+		size_t effect_inputs;
+		size_t effect_outputs;
+		bool declared;
+		Arena::Mark arena_mark;
+		double compile_start;
+		std::vector<FunctionWord *> used;
+	};
+	std::vector<Definition> suspended;
 
 	Engine();
+
+	void CreateWord(FunctionWord *word);
+	void FinishFunction(const std::string &word);
+	void SuspendWord();
+	void ResumeWord();
+
+	Control &GetControl(Control::Kind kind, const char *word);
+	Control &GetLoop(size_t depth, const char *word);
+	void SaveState(std::vector<llvm::Value *> &state);
+	void RestoreState(const std::vector<llvm::Value *> &state);
+	void AddExit(Control &c);
+	void JoinExits(Control &c, const char *word);
+	void StartLoop(Control &loop);
+	void CloseLoop(Control &loop);
+	void StartDo(bool check);
+	void FinishDo(llvm::Value *next, llvm::Value *test);
+	llvm::Value *CarryArgument(llvm::Value *arg);
+	void DeclareCurrent(const char *word);
 public:
 	~Engine();
 
 	static Engine &GetSingleton();
 
-	std::list<int> runtime_stack;
-	std::list<WordIndex *> compiler_stack;
-	std::list<ArgumentWord *> compiler_args;
+	DataStack runtime_stack;
+	std::vector<WordIndex *> compiler_stack;
+	std::vector<ArgumentWord *> compiler_args;
 
 	void SetInputStream(std::istream &in);
+	void SetInputFile(const std::string &filename);
 	void SetVerbose(bool verbose) { this->verbose = verbose; }
 	bool GetVerbose() { return verbose; }
+	void SetBatch(bool batch) { this->batch = batch; }
+	unsigned GetThreshold() { return threshold; }
+	void SetThreshold(unsigned threshold) { this->threshold = threshold; }
+	bool IsCompiling() { return compiling; }
 	Lexer *GetLexer() { return lexer; }
 	FunctionWord *GetLatest() { return latest; }
+	Dictionary *GetDictionary() { return &dictionary; }
+	Arena &GetArena() { return arena; }
+	Cache *GetCache() { return cache; }
+	void SetCache(Cache *cache) { this->cache = cache; }
+
+	// finished words keep only machine code, when nothing will read
+	// their ir again
+	void SetRelease(bool release) { this->release = release; }
+	bool IsLive() { return live; }
+	void SetLive(bool live) { this->live = live; }
 
 	void MainLoop();
-	Word *FindWord(const std::string& word);
-	void ExecuteWord(const std::string& word);
+	Word *FindWord(const Token &word) { return dictionary.Find(word); }
+	Word *FindWord(const std::string &word) { return dictionary.Find(Token(word.data(), word.size())); }
+	void AddWord(Word *word) { dictionary.Add(word->GetName(), word); }
+	void ExecuteWord(const Token &word);
+	void BatchWord(const Token &word);
+	void FlushBatch();
+	bool ParseNumber(const Token &word, cell &number);
+	bool ParseFloat(const Token &word, double &number);
 
-	void CreateExternWord(const std::string &word, size_t inputs, size_t outputs);
+	void CreateExternWord(const std::string &word, const std::string &signature);
 	void CreateWord();
-	void FinishWord(const std::string& word);
+	void CompileWord(const Token &word);
+	void CompileInstance(Word *word);
+	void CompileOutputs();
+	FunctionWord *FinishWord(const std::string& word);
+
+	uint64_t HashDefinition(const std::string &word, bool known, size_t inputs, size_t outputs);
+	bool LoadDefinition(const std::string &word, uint64_t key);
+	void StoreDefinition(uint64_t key);
+	void ReleaseDefinition();
+
+	void UseWord(FunctionWord *word);
+	void Relink(const std::string &word, const char *source);
+
+	bool ThreadWord(ThreadedCode *code, const Token &word);
+	void Replay(ThreadedCode *code);
+	FunctionWord *FinishThreadedWord(const std::string &word, ThreadedCode *code);
+	void Promote(FunctionWord *word);
+	void SetStackEffect(const std::string &word, bool known, size_t inputs, size_t outputs);
+	void PrintStatistics();
 	void Push(WordInstance *instance);
+	void PushValue(llvm::Value *value);
+	WordIndex *CreateValue(llvm::Value *value);
 	WordIndex *Pop();
+	WordIndex *Pop(const llvm::Type *type);
+	WordIndex *PopArgument(const llvm::Type *type);
+	void ReplaceValue(llvm::Value *from, llvm::Value *to);
+
+	void If();
+	void Else();
+	void Then();
+	void Begin();
+	void Until();
+	void While();
+	void Repeat();
+	void Do();
+	void QuestionDo();
+	void Loop();
+	void PlusLoop();
+	void LoopIndex();
+	void OuterLoopIndex();
+	void LeaveLoop();
+	void Recurse();
+	void Recursive();
 };
 
@@ -1,30 +1,366 @@
 #include "jit.h"
 #include <llvm/Analysis/Verifier.h>
 #include <llvm/CallingConv.h>
+#include <llvm/Target/TargetOptions.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetMachineRegistry.h>
+#include <llvm/Target/SubtargetFeature.h>
+#include <llvm/CodeGen/LinkAllCodegenComponents.h>
+#include <llvm/CodeGen/LinkAllAsmWriterComponents.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Linker.h>
+#include <llvm/Support/CFG.h>
 #include <iostream>
 #include <dlfcn.h>
+#include <algorithm>
+#include <memory>
 
 static void *findSymbol(const std::string &str)
 {
-	JIT::GetSingleton().FindSymbol(str);
+	return JIT::GetSingleton().FindSymbol(str);
 }
 
-JIT::JIT() : module("llforth")
+static const llvm::Type *GetReturnType(const std::vector<const llvm::Type *> &rets)
 {
-	optimize = false;
+	// outputs are returned by value, a struct when there are several
+	if(rets.empty())
+		return llvm::Type::VoidTy;
+	else if(rets.size() == 1)
+		return rets[0];
+	else
+		return llvm::StructType::get(rets);
+}
+
+static llvm::Value *FromCell(llvm::IRBuilder<> &b, llvm::Value *value, const llvm::Type *type)
+{
+	// same layout as CellToFloat
+	unsigned cell_bits = value->getType()->getPrimitiveSizeInBits();
+	unsigned bits = type->getPrimitiveSizeInBits();
+	if(type->isFloatingPoint())
+	{
+		if(bits > cell_bits)
+			return b.CreateFPExt(b.CreateBitCast(value, llvm::Type::FloatTy), type);
+		if(bits < cell_bits)
+			value = b.CreateTrunc(value, llvm::IntegerType::get(bits));
+		return b.CreateBitCast(value, type);
+	}
+	if(bits < cell_bits)
+		return b.CreateTrunc(value, type);
+	return value;
+}
+
+static llvm::Value *ToCell(llvm::IRBuilder<> &b, llvm::Value *value, const llvm::Type *cell_type)
+{
+	// same layout as FloatToCell
+	const llvm::Type *type = value->getType();
+	unsigned cell_bits = cell_type->getPrimitiveSizeInBits();
+	unsigned bits = type->getPrimitiveSizeInBits();
+	if(type->isFloatingPoint())
+	{
+		if(bits > cell_bits)
+			return b.CreateBitCast(b.CreateFPTrunc(value, llvm::Type::FloatTy), cell_type);
+		value = b.CreateBitCast(value, llvm::IntegerType::get(bits));
+		return bits < cell_bits ? b.CreateZExt(value, cell_type) : value;
+	}
+	if(bits < cell_bits)
+		return b.CreateSExt(value, cell_type);
+	return value;
+}
+
+static const llvm::Type *GetForthType(const llvm::Type *type, const llvm::Type *cell_type)
+{
+	// the compile time stack holds cells and doubles
+	return type->isFloatingPoint() ? llvm::Type::DoubleTy : cell_type;
+}
+
+static llvm::Value *FromForth(llvm::IRBuilder<> &b, llvm::Value *value, const llvm::Type *type)
+{
+	if(value->getType() == type)
+		return value;
+	if(llvm::isa<llvm::PointerType>(type))
+		return b.CreateIntToPtr(value, type);
+	if(type->isFloatingPoint())
+		return b.CreateFPTrunc(value, type);
+	return b.CreateIntCast(value, type, true);
+}
+
+static llvm::Value *ToForth(llvm::IRBuilder<> &b, llvm::Value *value, const llvm::Type *cell_type)
+{
+	const llvm::Type *type = value->getType();
+	if(type == cell_type || type == llvm::Type::DoubleTy)
+		return value;
+	if(llvm::isa<llvm::PointerType>(type))
+		return b.CreatePtrToInt(value, cell_type);
+	if(type->isFloatingPoint())
+		return b.CreateFPExt(value, llvm::Type::DoubleTy);
+	return b.CreateIntCast(value, cell_type, true);
+}
+
+static llvm::CallInst *GetTailCall(llvm::BasicBlock *block, const std::vector<llvm::Value *> &outputs)
+{
+	// a call is in tail position when its results are returned as they
+	// are, only the extractvalues of the results may follow it
+	llvm::BasicBlock::iterator it = block->end();
+	size_t extracts = outputs.size() > 1 ? outputs.size() : 0;
+	for(size_t i = 0; i < extracts && it != block->begin(); i++)
+		it--;
+	if(it == block->begin())
+		return NULL;
+	llvm::CallInst *call = llvm::dyn_cast<llvm::CallInst>(--it);
+	if(call == NULL)
+		return NULL;
+
+	if(outputs.empty())
+		return call->getType() == llvm::Type::VoidTy ? call : NULL;
+	if(outputs.size() == 1)
+		return outputs[0] == call ? call : NULL;
+	for(size_t i = 0; i < outputs.size(); i++)
+	{
+		llvm::ExtractValueInst *extract = llvm::dyn_cast<llvm::ExtractValueInst>(outputs[i]);
+		if(extract == NULL || extract->getAggregateOperand() != call || *extract->idx_begin() != i)
+			return NULL;
+	}
+	return call;
+}
+
+JIT::JIT() : module("llforth"), entry_module("llforth.entry")
+{
+	optimize = 0;
+	lazy = false;
+	fpm = NULL;
+	cell_type = llvm::IntegerType::get(sizeof(cell) * 8);
 	latest = NULL;
-	builder = NULL;
+	declared = NULL;
+	arena = NULL;
+	builder = new llvm::IRBuilder<>();
+
+	// host words throw through jitted frames
+	llvm::ExceptionHandling = true;
+
+	// fastcc calls marked tail are guaranteed to reuse the frame
+	llvm::PerformTailCallOpt = true;
 
 	jit = llvm::ExecutionEngine::create(&module);
 	jit->InstallLazyFunctionCreator(findSymbol);
+	jit->addModuleProvider(new llvm::ExistingModuleProvider(&entry_module));
 
 	module_provider = new llvm::ExistingModuleProvider(&module);
+}
+
+template<class PM> static void AddFunctionPasses(PM &pm, unsigned level)
+{
+	// allocas go to registers first so every later pass sees ssa values
+	pm.add(llvm::createPromoteMemoryToRegisterPass());
+	pm.add(llvm::createInstructionCombiningPass());
+	pm.add(llvm::createCFGSimplificationPass());
+	if(level < 2)
+		return;
+
+	if(level > 2)
+		pm.add(llvm::createScalarReplAggregatesPass());
+	pm.add(llvm::createReassociatePass());
+	pm.add(llvm::createGVNPass());
+	pm.add(llvm::createSCCPPass());
+	pm.add(llvm::createInstructionCombiningPass());
+	pm.add(llvm::createCFGSimplificationPass());
+
+	// counted loops come out with a phi induction variable
+	pm.add(llvm::createLoopRotatePass());
+	pm.add(llvm::createLICMPass());
+	if(level > 2)
+		pm.add(llvm::createLoopUnswitchPass());
+	pm.add(llvm::createIndVarSimplifyPass());
+	if(level > 2)
+		pm.add(llvm::createLoopUnrollPass());
+	pm.add(llvm::createLoopDeletionPass());
+	pm.add(llvm::createInstructionCombiningPass());
+	pm.add(llvm::createGVNPass());
+	pm.add(llvm::createMemCpyOptPass());
+	pm.add(llvm::createDeadStoreEliminationPass());
+
+	// self recursion becomes a loop once returns are folded
+	pm.add(llvm::createTailCallEliminationPass());
+	pm.add(llvm::createAggressiveDCEPass());
+	pm.add(llvm::createCFGSimplificationPass());
+}
+
+void JIT::SetOptimize(unsigned level)
+{
+	optimize = level;
+	delete fpm;
+	fpm = NULL;
+	if(level == 0)
+		return;
+
 	fpm = new llvm::FunctionPassManager(module_provider);
 	fpm->add(new llvm::TargetData(*jit->getTargetData()));
-	fpm->add(llvm::createReassociatePass());
-	fpm->add(llvm::createGVNPass());
-	fpm->add(llvm::createCFGSimplificationPass());
-	fpm->add(llvm::createPromoteMemoryToRegisterPass());
+	AddFunctionPasses(*fpm, level);
+}
+
+void JIT::Materialize(llvm::Function *function)
+{
+	// everything a call can reach is optimized before any of it becomes
+	// machine code, the jit stubs compile callees on their first call
+	if(pending.erase(function) == 0)
+		return;
+	fpm->run(*function);
+
+	for(llvm::Function::iterator block = function->begin(); block != function->end(); block++)
+		for(llvm::BasicBlock::iterator it = block->begin(); it != block->end(); it++)
+			if(llvm::CallInst *call = llvm::dyn_cast<llvm::CallInst>(it))
+				if(llvm::Function *callee = call->getCalledFunction())
+					Materialize(callee);
+}
+
+void JIT::OptimizeModule()
+{
+	// the module pipeline runs the function passes on every word
+	pending.clear();
+	if(optimize == 0)
+		return;
+
+	// linked helpers are private to the output, dead argument elimination
+	// and ipsccp only change internal functions
+	for(std::set<llvm::Function *>::iterator it = linked.begin(); it != linked.end(); it++)
+		if((*it)->getName() != "main")
+			(*it)->setLinkage(llvm::GlobalValue::InternalLinkage);
+
+	// words keep external linkage, inlined copies don't remove them
+	llvm::PassManager pm;
+	pm.add(new llvm::TargetData(&module));
+	pm.add(llvm::createGlobalOptimizerPass());
+	pm.add(llvm::createIPSCCPPass());
+	pm.add(llvm::createDeadArgEliminationPass());
+	pm.add(llvm::createInstructionCombiningPass());
+	pm.add(llvm::createCFGSimplificationPass());
+	pm.add(llvm::createPruneEHPass());
+	if(optimize > 1)
+		pm.add(llvm::createFunctionInliningPass());
+	if(optimize > 2)
+		pm.add(llvm::createArgumentPromotionPass());
+	AddFunctionPasses(pm, optimize);
+	pm.add(llvm::createStripDeadPrototypesPass());
+	pm.add(llvm::createGlobalDCEPass());
+	pm.add(llvm::createConstantMergePass());
+	pm.run(module);
+}
+
+void JIT::CreateEntryPoint()
+{
+	// host words called at run time bind to runtime.o by their c names
+	for(llvm::Module::iterator it = module.begin(); it != module.end(); it++)
+	{
+		if(!it->isDeclaration() || it->use_empty())
+			continue;
+		std::map<std::string, std::string>::iterator found = runtime_symbols.find(it->getName());
+		if(found != runtime_symbols.end())
+			it->setName(found->second);
+		else if(extern_symbols.find(it->getName()) != extern_symbols.end())
+			throw std::string(it->getName()) + " isn't available in executables";
+	}
+
+	llvm::Function *word = module.getFunction("main");
+	if(word == NULL || word->isDeclaration())
+		throw std::string("no main word");
+	if(word->arg_size() != 0)
+		throw std::string("main can't take inputs");
+	word->setName("forth.main");
+
+	// int main(), a single cell output is the exit status
+	llvm::FunctionType *type = llvm::FunctionType::get(llvm::Type::Int32Ty, std::vector<const llvm::Type *>(), false);
+	llvm::Function *entry = llvm::Function::Create(type, llvm::Function::ExternalLinkage, "main", &module);
+	llvm::IRBuilder<> b(llvm::BasicBlock::Create("entry", entry));
+	llvm::CallInst *call = b.CreateCall(word);
+	call->setCallingConv(word->getCallingConv());
+	if(call->getType()->isInteger())
+		b.CreateRet(b.CreateIntCast(call, llvm::Type::Int32Ty, true));
+	else
+		b.CreateRet(llvm::ConstantInt::get(llvm::Type::Int32Ty, 0));
+	llvm::verifyFunction(*entry);
+}
+
+llvm::GlobalVariable *JIT::CreateSlot(llvm::Function *function)
+{
+	// callers load the slot, so materialize never reaches the function
+	// through their calls
+	Materialize(function);
+
+	// never stored in the ir, globalopt turns it into direct calls
+	const llvm::Type *type = llvm::PointerType::getUnqual(function->getFunctionType());
+	return new llvm::GlobalVariable(type, false, llvm::GlobalValue::InternalLinkage, function, "slot." + function->getName(), &module, false);
+}
+
+void JIT::PatchSlot(llvm::GlobalVariable *slot, llvm::Function *function)
+{
+	// compiled callers load the slot on every call
+	slot->setInitializer(function);
+	Materialize(function);
+	void **address = (void **)jit->getPointerToGlobal(slot);
+	*address = jit->getPointerToFunction(function);
+}
+
+void JIT::Partition(unsigned part, unsigned parts)
+{
+	// keep every parts-th word from part, the others become declarations
+	// that the linker resolves against the other parts, linked helpers
+	// included
+	linked.clear();
+	unsigned index = 0;
+	for(llvm::Module::iterator it = module.begin(); it != module.end(); it++)
+		if(!it->isDeclaration())
+		{
+			if(index++ % parts != part)
+				it->deleteBody();
+			it->setLinkage(llvm::GlobalValue::ExternalLinkage);
+		}
+
+	// variables and strings are shared, the first part defines them, the
+	// renames come out the same in every part
+	for(llvm::Module::global_iterator it = module.global_begin(); it != module.global_end(); it++)
+	{
+		if(it->hasInternalLinkage())
+		{
+			it->setName(it->hasName() ? "forth." + it->getName() : "forth.data");
+			it->setLinkage(llvm::GlobalValue::ExternalLinkage);
+		}
+		if(part != 0)
+			it->setInitializer(NULL);
+	}
+}
+
+void JIT::EmitAssembly(const std::string &filename, const std::string &cpu)
+{
+	std::string error;
+	const llvm::TargetMachineRegistry::entry *target = llvm::TargetMachineRegistry::getClosestStaticTargetForModule(module, error);
+	if(target == NULL)
+		throw std::string("no target: ") + error;
+
+	// an empty cpu is the generic one of the target
+	llvm::SubtargetFeatures features;
+	features.setCPU(cpu);
+	std::auto_ptr<llvm::TargetMachine> machine(target->CtorFn(module, features.getString()));
+
+	llvm::raw_fd_ostream out(filename.c_str(), false, error);
+	if(!error.empty())
+		throw std::string("can't open ") + filename + ": " + error;
+
+	// the jit module provider, the codegen passes only read the ir
+	bool fast = optimize == 0;
+	llvm::FunctionPassManager passes(module_provider);
+	passes.add(new llvm::TargetData(*machine->getTargetData()));
+	if(machine->addPassesToEmitFile(passes, out, llvm::TargetMachine::AssemblyFile, fast) != llvm::FileModel::AsmFile)
+		throw std::string("can't emit assembly for ") + target->Name;
+	if(machine->addPassesToEmitFileFinish(passes, (llvm::MachineCodeEmitter *)NULL, fast))
+		throw std::string("can't emit assembly for ") + target->Name;
+
+	passes.doInitialization();
+	for(llvm::Module::iterator it = module.begin(); it != module.end(); it++)
+		if(!it->isDeclaration())
+			passes.run(*it);
+	passes.doFinalization();
 }
 
 JIT &JIT::GetSingleton()
@@ -33,96 +369,557 @@ JIT &JIT::GetSingleton()
 	return jit;
 }
 
-llvm::Value *JIT::CreateInputArgument()
+llvm::Value *JIT::CreateInputArgument(const llvm::Type *type)
 {
-	llvm::Argument *arg = new llvm::Argument(llvm::Type::Int32Ty);
+	llvm::Argument *arg = new (*arena) llvm::Argument(type);
 	inp_args.push_back(arg);
 	return arg;
 }
 
-llvm::Value *JIT::CreateOutputArgument()
+llvm::Value *JIT::RetypeArgument(llvm::Value *arg, const llvm::Type *type)
 {
-	llvm::Argument *arg = new llvm::Argument(llvm::PointerType::getUnqual(llvm::Type::Int32Ty));
-	out_args.push_back(arg);
-	return arg;
+	// only an argument nothing has used yet can take another type
+	if(!arg->use_empty())
+		return NULL;
+	for(size_t i = 0; i < inp_args.size(); i++)
+		if(inp_args[i] == arg)
+		{
+			inp_args[i]->~Argument();
+			inp_args[i] = new (*arena) llvm::Argument(type);
+			return inp_args[i];
+		}
+	return NULL;
 }
 
-void JIT::CreateExternWord(const std::string &word, size_t inputs, size_t outputs)
+void JIT::AddOutput(llvm::Value *value)
 {
-	std::vector<const llvm::Type *> args;
+	outputs.push_back(value);
+}
+
+llvm::Value *JIT::CreateEntryAlloca(const llvm::Type *type)
+{
+	// allocas at the top of the entry block can go to registers
+	if(latest_entry->empty())
+		return new llvm::AllocaInst(type, 0, "", latest_entry);
+	else
+		return new llvm::AllocaInst(type, 0, "", &latest_entry->front());
+}
+
+llvm::Value *JIT::InlineCall(llvm::Function *function, const std::vector<llvm::Value *> &arguments)
+{
+	// primitives are a single block, clone it at the insert point
+	assert(function->size() == 1);
+	std::map<const llvm::Value *, llvm::Value *> values;
+	llvm::Function::arg_iterator arg = function->arg_begin();
+	for(size_t i = 0; i < arguments.size(); i++, arg++)
+		values[&*arg] = arguments[i];
+
+	llvm::BasicBlock &block = function->front();
+	for(llvm::BasicBlock::iterator it = block.begin(); it != block.end(); it++)
+	{
+		if(llvm::ReturnInst *ret = llvm::dyn_cast<llvm::ReturnInst>(it))
+		{
+			if(ret->getNumOperands() == 0)
+				return NULL;
+			llvm::Value *value = ret->getOperand(0);
+			return values.count(value) ? values[value] : value;
+		}
+
+		// allocas stay out of loops
+		if(llvm::AllocaInst *alloca = llvm::dyn_cast<llvm::AllocaInst>(it))
+		{
+			values[&*it] = CreateEntryAlloca(alloca->getAllocatedType());
+			continue;
+		}
+
+		if(llvm::IntToPtrInst *cast = llvm::dyn_cast<llvm::IntToPtrInst>(it))
+		{
+			llvm::Value *cell = cast->getOperand(0);
+			values[&*it] = CreateAddress(values.count(cell) ? values[cell] : cell, cast->getType());
+			continue;
+		}
+
+		llvm::Instruction *copy = it->clone();
+		for(unsigned i = 0; i < copy->getNumOperands(); i++)
+			if(values.count(copy->getOperand(i)))
+				copy->setOperand(i, values[copy->getOperand(i)]);
+		values[&*it] = builder->Insert(copy);
+	}
+
+	return NULL;
+}
+
+static llvm::GlobalVariable *GetVariable(llvm::Value *cell)
+{
+	llvm::ConstantExpr *expr = llvm::dyn_cast<llvm::ConstantExpr>(cell);
+	if(expr == NULL || expr->getOpcode() != llvm::Instruction::PtrToInt)
+		return NULL;
+	return llvm::dyn_cast<llvm::GlobalVariable>(expr->getOperand(0));
+}
+
+llvm::Value *JIT::CreateAddress(llvm::Value *cell, const llvm::Type *type)
+{
+	// a variable or a variable plus an offset is a gep on its global, so
+	// alias analysis still sees which object the address is in
+	llvm::User *add = NULL;
+	if(llvm::BinaryOperator *op = llvm::dyn_cast<llvm::BinaryOperator>(cell))
+		add = op->getOpcode() == llvm::Instruction::Add ? op : NULL;
+	else if(llvm::ConstantExpr *expr = llvm::dyn_cast<llvm::ConstantExpr>(cell))
+		add = expr->getOpcode() == llvm::Instruction::Add ? expr : NULL;
 
+	llvm::GlobalVariable *global = GetVariable(cell);
+	llvm::Value *offset = NULL;
+	if(global == NULL && add != NULL)
+		for(unsigned i = 0; i < 2 && global == NULL; i++)
+		{
+			global = GetVariable(add->getOperand(i));
+			offset = add->getOperand(1 - i);
+		}
+	if(global == NULL)
+		return builder->CreateIntToPtr(cell, type);
+
+	llvm::Value *address = builder->CreateBitCast(global, llvm::PointerType::getUnqual(llvm::Type::Int8Ty));
+	if(offset != NULL)
+		address = builder->CreateGEP(address, offset);
+	return builder->CreateBitCast(address, type);
+}
+
+bool JIT::CreateExternWord(const std::string &word, const std::vector<const llvm::Type *> &inputs, const std::vector<const llvm::Type *> &outputs)
+{
 	// input arguments
-	for(size_t i = 0; i < inputs; i++)
-		args.push_back(llvm::Type::Int32Ty);
+	std::vector<const llvm::Type *> args(inputs);
 
-	// output arguments
+	// output arguments, the c abi returns more than one through pointers
 	const llvm::Type *ret_type = llvm::Type::VoidTy;
-	if(outputs == 1)
-		ret_type = llvm::Type::Int32Ty;
-	else if(outputs > 19)
-		for(size_t i = 0; i < outputs; i++)
-			args.push_back(llvm::PointerType::getUnqual(llvm::Type::Int32Ty));
+	if(outputs.size() == 1)
+		ret_type = outputs[0];
+	else if(outputs.size() > 1)
+		for(size_t i = 0; i < outputs.size(); i++)
+			args.push_back(llvm::PointerType::getUnqual(outputs[i]));
 	
-	// create function
+	// create function, bound now when the symbol is already loaded, the
+	// lazy creator stays for what only the output links against
 	llvm::FunctionType *ftype = llvm::FunctionType::get(ret_type, args, false);
-	latest = llvm::Function::Create(ftype, llvm::Function::ExternalLinkage, word, &module);
+	llvm::Function *function = module.getFunction(word);
+	if(function != NULL && function->getFunctionType() != ftype)
+		throw std::string("extern ") + word + " redeclared with another signature";
+	if(function == NULL)
+	{
+		function = llvm::Function::Create(ftype, llvm::Function::ExternalLinkage, word, &module);
+		void *address = FindSymbol(word);
+		if(address != NULL)
+			jit->addGlobalMapping(function, address);
+	}
+	latest = function;
+
+	// cells and doubles need no conversion
+	bool forth = true;
+	for(size_t i = 0; i < inputs.size(); i++)
+		forth = forth && GetForthType(inputs[i], cell_type) == inputs[i];
+	for(size_t i = 0; i < outputs.size(); i++)
+		forth = forth && GetForthType(outputs[i], cell_type) == outputs[i];
+	if(forth)
+		return false;
+
+	// the others get a wrapper over stack types that callers inline, what
+	// remains is the casts and a direct call
+	std::vector<const llvm::Type *> forth_args;
+	std::vector<const llvm::Type *> forth_rets;
+	for(size_t i = 0; i < inputs.size(); i++)
+		forth_args.push_back(GetForthType(inputs[i], cell_type));
+	for(size_t i = 0; i < outputs.size(); i++)
+		forth_rets.push_back(GetForthType(outputs[i], cell_type));
+	const llvm::Type *forth_ret = GetReturnType(forth_rets);
+	llvm::FunctionType *wrapper_type = llvm::FunctionType::get(forth_ret, forth_args, false);
+	llvm::Function *wrapper = llvm::Function::Create(wrapper_type, llvm::Function::InternalLinkage, "extern." + word, &module);
+
+	llvm::IRBuilder<> b(llvm::BasicBlock::Create("entry", wrapper));
+	std::vector<llvm::Value *> arguments;
+	llvm::Function::arg_iterator it = wrapper->arg_begin();
+	for(size_t i = 0; i < inputs.size(); i++, it++)
+		arguments.push_back(FromForth(b, it, inputs[i]));
+	std::vector<llvm::Value *> slots;
+	if(outputs.size() > 1)
+		for(size_t i = 0; i < outputs.size(); i++)
+		{
+			slots.push_back(b.CreateAlloca(outputs[i]));
+			arguments.push_back(slots.back());
+		}
+	llvm::CallInst *call = b.CreateCall<std::vector<llvm::Value *>::iterator>(function, arguments.begin(), arguments.end());
+
+	std::vector<llvm::Value *> results;
+	if(outputs.size() == 1)
+		results.push_back(ToForth(b, call, cell_type));
+	for(size_t i = 0; i < slots.size(); i++)
+		results.push_back(ToForth(b, b.CreateLoad(slots[i]), cell_type));
+	if(results.empty())
+		b.CreateRetVoid();
+	else if(results.size() == 1)
+		b.CreateRet(results[0]);
+	else
+	{
+		llvm::Value *ret = llvm::UndefValue::get(forth_ret);
+		for(size_t i = 0; i < results.size(); i++)
+			ret = b.CreateInsertValue(ret, results[i], i);
+		b.CreateRet(ret);
+	}
+	llvm::verifyFunction(*wrapper);
+
+	latest = wrapper;
+	return true;
 }
 
 void JIT::CreateWord()
 {
 	// create entry
-	latest_entry = llvm::BasicBlock::Create("entry");
-	builder = new llvm::IRBuilder<>(latest_entry);
+	declared = NULL;
+	blocks.clear();
+	latest_entry = CreateBlock("entry");
+	SetBlock(latest_entry);
 }
 
-void JIT::FinishWord(const std::string &word)
+void JIT::SetBlock(llvm::BasicBlock *block)
+{
+	// blocks join the function in the order they are filled
+	blocks.push_back(block);
+	builder->SetInsertPoint(block);
+}
+
+void JIT::DeclareWord(const std::string &word, size_t inputs, size_t outputs)
 {
-	size_t inputs = inp_args.size();
-	size_t outputs = out_args.size();
+	// the function exists before its body so the body can call it
+	std::vector<const llvm::Type *> args(inputs, cell_type);
+	std::vector<const llvm::Type *> rets(outputs, cell_type);
+	llvm::FunctionType *ftype = llvm::FunctionType::get(GetReturnType(rets), args, false);
+	declared = llvm::Function::Create(ftype, llvm::Function::ExternalLinkage, word, &module);
+	declared->setCallingConv(llvm::CallingConv::Fast);
+	latest = declared;
+}
 
+void JIT::FinishWord(const std::string &word)
+{
 	// argument types
-	std::vector<const llvm::Type *> args(inputs + outputs);
-	for(size_t i = 0; i < inputs; i++)
-		args[i] = llvm::Type::Int32Ty;
-	for(size_t i = inputs; i < inputs + outputs; i++)
-		args[i] = llvm::PointerType::getUnqual(llvm::Type::Int32Ty);
-
-	// create function
-	llvm::FunctionType *ftype = llvm::FunctionType::get(llvm::Type::VoidTy, args, false);
-	latest = llvm::Function::Create(ftype, llvm::Function::ExternalLinkage, word, &module);
-	if(optimize)
-		latest->setCallingConv(llvm::CallingConv::Fast);
-	latest->getBasicBlockList().push_back(latest_entry);
+	std::vector<const llvm::Type *> args(inp_args.size());
+	for(size_t i = 0; i < inp_args.size(); i++)
+		args[i] = inp_args[i]->getType();
 
-	// fix input args
-	std::list<llvm::Argument *>::iterator it1 = inp_args.begin();
-	llvm::Function::arg_iterator it = latest->arg_begin();
-	while(it1 != inp_args.end())
+	std::vector<const llvm::Type *> rets(outputs.size());
+	for(size_t i = 0; i < outputs.size(); i++)
+		rets[i] = outputs[i]->getType();
+	const llvm::Type *ret_type = GetReturnType(rets);
+
+	CreateReturn(builder->GetInsertBlock(), outputs, ret_type);
+	outputs.clear();
+
+	// create function, recursive words declared theirs up front
+	llvm::FunctionType *ftype = llvm::FunctionType::get(ret_type, args, false);
+	if(declared != NULL)
 	{
-		(*it1)->replaceAllUsesWith(&*it);
-		delete *it1;
-		it1++;
-		it++;
+		latest = declared;
+		declared = NULL;
+		if(latest->getFunctionType() != ftype)
+			throw std::string("stack effect mismatch in ") + word;
 	}
-	inp_args.clear();
+	else
+	{
+		latest = llvm::Function::Create(ftype, llvm::Function::ExternalLinkage, word, &module);
+		latest->setCallingConv(llvm::CallingConv::Fast);
+	}
+	for(size_t i = 0; i < blocks.size(); i++)
+		latest->getBasicBlockList().push_back(blocks[i]);
+	blocks.clear();
 
-	// fix output args
-	it1 = out_args.begin();
-	while(it1 != out_args.end())
+	// fix input args, placeholders live in the engine arena
+	llvm::Function::arg_iterator it = latest->arg_begin();
+	for(size_t i = 0; i < inp_args.size(); i++, it++)
 	{
-		(*it1)->replaceAllUsesWith(&*it);
-		delete *it1;
-		it1++;
-		it++;
+		inp_args[i]->replaceAllUsesWith(&*it);
+		inp_args[i]->~Argument();
 	}
-	out_args.clear();
+	inp_args.clear();
 
 	// optimize jit function
 	llvm::verifyFunction(*latest);
-	if(optimize)
+	if(optimize > 0)
+		InlineLinked(latest);
+	if(fpm != NULL && lazy)
+		pending.insert(latest);
+	else if(fpm != NULL)
 		fpm->run(*latest);
 }
 
+void JIT::CreateReturn(llvm::BasicBlock *block, const std::vector<llvm::Value *> &values, const llvm::Type *ret_type)
+{
+	// a join of branches returns from each branch that jumps to it, so
+	// calls before then, else and friends are in tail position too
+	if(block->getFirstNonPHI() == block->end() && llvm::pred_begin(block) != llvm::pred_end(block))
+	{
+		std::vector<llvm::BasicBlock *> preds(llvm::pred_begin(block), llvm::pred_end(block));
+		for(size_t i = 0; i < preds.size(); i++)
+		{
+			llvm::BranchInst *br = llvm::dyn_cast<llvm::BranchInst>(preds[i]->getTerminator());
+			if(br == NULL || br->isConditional())
+				continue;
+
+			std::vector<llvm::Value *> incoming(values);
+			for(size_t j = 0; j < incoming.size(); j++)
+				if(llvm::PHINode *phi = llvm::dyn_cast<llvm::PHINode>(incoming[j]))
+					if(phi->getParent() == block)
+						incoming[j] = phi->getIncomingValueForBlock(preds[i]);
+			for(llvm::BasicBlock::iterator it = block->begin(); it != block->end(); it++)
+				llvm::cast<llvm::PHINode>(it)->removeIncomingValue(preds[i], false);
+			br->eraseFromParent();
+			CreateReturn(preds[i], incoming, ret_type);
+		}
+
+		// every branch returned, the join is dead
+		if(llvm::pred_begin(block) == llvm::pred_end(block))
+		{
+			while(!block->empty())
+			{
+				llvm::Instruction *phi = &block->front();
+				phi->replaceAllUsesWith(llvm::UndefValue::get(phi->getType()));
+				phi->eraseFromParent();
+			}
+			blocks.erase(std::find(blocks.begin(), blocks.end(), block));
+			delete block;
+			return;
+		}
+	}
+
+	// a tail call returns the callee results directly
+	builder->SetInsertPoint(block);
+	llvm::CallInst *tail = GetTailCall(block, values);
+	if(tail != NULL && tail->getType() == ret_type)
+	{
+		tail->setTailCall();
+		if(values.empty())
+			builder->CreateRetVoid();
+		else
+			builder->CreateRet(tail);
+	}
+	else if(values.empty())
+		builder->CreateRetVoid();
+	else if(values.size() == 1)
+		builder->CreateRet(values[0]);
+	else
+	{
+		llvm::Value *ret = llvm::UndefValue::get(ret_type);
+		for(size_t i = 0; i < values.size(); i++)
+			ret = builder->CreateInsertValue(ret, values[i], i);
+		builder->CreateRet(ret);
+	}
+}
+
+void JIT::SuspendWord()
+{
+	suspended.push_back(Definition());
+	Definition &d = suspended.back();
+	d.entry = latest_entry;
+	d.block = builder->GetInsertBlock();
+	d.declared = declared;
+	d.blocks.swap(blocks);
+	d.inp_args.swap(inp_args);
+	d.outputs.swap(outputs);
+}
+
+void JIT::ResumeWord()
+{
+	Definition &d = suspended.back();
+	latest_entry = d.entry;
+	if(d.block != NULL)
+		builder->SetInsertPoint(d.block);
+	blocks.swap(d.blocks);
+	declared = d.declared;
+	inp_args.swap(d.inp_args);
+	outputs.swap(d.outputs);
+	suspended.pop_back();
+}
+
+void JIT::DeleteFunction(llvm::Function *function)
+{
+	pending.erase(function);
+	jit->freeMachineCodeForFunction(function);
+	function->eraseFromParent();
+}
+
+void JIT::ReleaseBody(llvm::Function *function)
+{
+	// machine code now, calls compiled later go to its address and the
+	// declaration stays for them
+	Materialize(function);
+	jit->getPointerToFunction(function);
+	function->deleteBody();
+}
+
+llvm::GlobalVariable *JIT::InternConstant(llvm::Constant *value)
+{
+	llvm::GlobalVariable *&global = constants[value];
+	if(global == NULL)
+		global = new llvm::GlobalVariable(value->getType(), true, llvm::GlobalValue::InternalLinkage, value, "str", &module, false);
+	return global;
+}
+
+llvm::GlobalVariable *JIT::InternString(const std::string &text)
+{
+	// zero terminated for c functions
+	return InternConstant(llvm::ConstantArray::get(text, true));
+}
+
+bool JIT::GetStringLiteral(llvm::Value *address, llvm::Value *size, std::string &text)
+{
+	// ptrtoint of a pooled string and a constant length, as s" leaves them
+	llvm::ConstantInt *length = llvm::dyn_cast<llvm::ConstantInt>(size);
+	llvm::ConstantExpr *expr = llvm::dyn_cast<llvm::ConstantExpr>(address);
+	if(length == NULL || expr == NULL || expr->getOpcode() != llvm::Instruction::PtrToInt)
+		return false;
+	llvm::GlobalVariable *global = llvm::dyn_cast<llvm::GlobalVariable>(expr->getOperand(0));
+	if(global == NULL || !global->isConstant() || !global->hasInitializer())
+		return false;
+
+	std::string data;
+	llvm::Constant *init = global->getInitializer();
+	if(llvm::ConstantArray *array = llvm::dyn_cast<llvm::ConstantArray>(init))
+	{
+		if(!array->isString())
+			return false;
+		data = array->getAsString();
+	}
+	else if(!llvm::isa<llvm::ConstantAggregateZero>(init))
+		return false;
+
+	if(length->getZExtValue() > data.size())
+		return false;
+	text = data.substr(0, length->getZExtValue());
+	return true;
+}
+
+JIT::EntryThunk JIT::GetEntryThunk(llvm::Function *function)
+{
+	const llvm::FunctionType *ftype = function->getFunctionType();
+	EntryKey key(ftype, function->getCallingConv());
+	EntryThunks::iterator found = entry_thunks.find(key);
+	if(found != entry_thunks.end())
+		return found->second;
+
+	// void entry(i8 *function, cell *cells)
+	std::vector<const llvm::Type *> args;
+	args.push_back(llvm::PointerType::getUnqual(llvm::Type::Int8Ty));
+	args.push_back(llvm::PointerType::getUnqual(cell_type));
+	llvm::FunctionType *entry_type = llvm::FunctionType::get(llvm::Type::VoidTy, args, false);
+	llvm::Function *entry = llvm::Function::Create(entry_type, llvm::Function::InternalLinkage, "entry", &entry_module);
+
+	llvm::Function::arg_iterator it = entry->arg_begin();
+	llvm::Value *target = it++;
+	llvm::Value *cells = it++;
+
+	llvm::IRBuilder<> b(llvm::BasicBlock::Create("entry", entry));
+	llvm::Value *callee = b.CreateBitCast(target, llvm::PointerType::getUnqual(ftype));
+
+	size_t inputs = 0;
+	for(unsigned i = 0; i < ftype->getNumParams(); i++)
+		if(!llvm::isa<llvm::PointerType>(ftype->getParamType(i)))
+			inputs++;
+
+	// load inputs, the first argument is the top of stack
+	std::vector<llvm::Value *> arguments;
+	std::vector<llvm::Value *> outputs;
+	for(unsigned i = 0; i < ftype->getNumParams(); i++)
+	{
+		const llvm::Type *type = ftype->getParamType(i);
+		if(const llvm::PointerType *ptype = llvm::dyn_cast<llvm::PointerType>(type))
+		{
+			llvm::Value *slot = b.CreateAlloca(ptype->getElementType());
+			arguments.push_back(slot);
+			outputs.push_back(slot);
+		}
+		else
+		{
+			llvm::Value *cell = b.CreateGEP(cells, llvm::ConstantInt::get(llvm::Type::Int32Ty, inputs - 1 - i));
+			arguments.push_back(FromCell(b, b.CreateLoad(cell), type));
+		}
+	}
+
+	llvm::CallInst *call = b.CreateCall<std::vector<llvm::Value *>::iterator>(callee, arguments.begin(), arguments.end());
+	call->setCallingConv(function->getCallingConv());
+
+	// store outputs from the bottom, the return value is the last one
+	size_t index = 0;
+	for(size_t i = 0; i < outputs.size(); i++, index++)
+		b.CreateStore(ToCell(b, b.CreateLoad(outputs[i]), cell_type), b.CreateGEP(cells, llvm::ConstantInt::get(llvm::Type::Int32Ty, index)));
+	const llvm::Type *ret_type = ftype->getReturnType();
+	if(const llvm::StructType *stype = llvm::dyn_cast<llvm::StructType>(ret_type))
+	{
+		for(unsigned i = 0; i < stype->getNumElements(); i++, index++)
+			b.CreateStore(ToCell(b, b.CreateExtractValue(call, i), cell_type), b.CreateGEP(cells, llvm::ConstantInt::get(llvm::Type::Int32Ty, index)));
+	}
+	else if(ret_type != llvm::Type::VoidTy)
+		b.CreateStore(ToCell(b, call, cell_type), b.CreateGEP(cells, llvm::ConstantInt::get(llvm::Type::Int32Ty, index)));
+	b.CreateRetVoid();
+
+	llvm::verifyFunction(*entry);
+	EntryThunk thunk = (EntryThunk)jit->getPointerToFunction(entry);
+	entry_thunks[key] = thunk;
+	return thunk;
+}
+
+size_t JIT::LinkBitcode(const std::string &filename)
+{
+	std::string error;
+	llvm::MemoryBuffer *buffer = llvm::MemoryBuffer::getFile(filename.c_str(), &error);
+	if(buffer == NULL)
+		throw std::string("can't open ") + filename + ": " + error;
+	llvm::Module *library = llvm::ParseBitcodeFile(buffer, &error);
+	delete buffer;
+	if(library == NULL)
+		throw std::string("can't read ") + filename + ": " + error;
+
+	std::vector<std::string> names;
+	for(llvm::Module::iterator it = library->begin(); it != library->end(); it++)
+		if(!it->isDeclaration() && !it->hasInternalLinkage())
+			names.push_back(it->getName());
+
+	// before any extern, the declarations find these definitions
+	bool failed = llvm::Linker::LinkModules(&module, library, &error);
+	delete library;
+	if(failed)
+		throw std::string("can't link ") + filename + ": " + error;
+
+	for(size_t i = 0; i < names.size(); i++)
+		linked.insert(module.getFunction(names[i]));
+	return names.size();
+}
+
+void JIT::InlineLinked(llvm::Function *function)
+{
+	// c helpers small enough to disappear into the word, the module
+	// pipeline decides for the rest when writing output
+	std::vector<llvm::CallInst *> calls;
+	for(llvm::Function::iterator block = function->begin(); block != function->end(); block++)
+		for(llvm::BasicBlock::iterator it = block->begin(); it != block->end(); it++)
+			if(llvm::CallInst *call = llvm::dyn_cast<llvm::CallInst>(it))
+				if(linked.count(call->getCalledFunction()))
+				{
+					size_t size = 0;
+					llvm::Function *callee = call->getCalledFunction();
+					for(llvm::Function::iterator b = callee->begin(); b != callee->end(); b++)
+						size += b->size();
+					if(size <= 64)
+						calls.push_back(call);
+				}
+
+	for(size_t i = 0; i < calls.size(); i++)
+		llvm::InlineFunction(calls[i]);
+}
+
+void JIT::LoadLibrary(const std::string &name)
+{
+	// global, dlsym(RTLD_DEFAULT) finds its symbols for later externs
+	if(dlopen(name.c_str(), RTLD_NOW | RTLD_GLOBAL) == NULL)
+		throw std::string("can't load ") + name + ": " + dlerror();
+	libraries.push_back(name);
+}
+
 void *JIT::FindSymbol(const std::string &str)
 {
 	if(extern_symbols.find(str) == extern_symbols.end())
@@ -9,45 +9,134 @@
 #include <llvm/LinkAllPasses.h>
 #include <llvm/Target/TargetData.h>
 #include <list>
+#include <vector>
 #include <map>
+#include <set>
+#include "stack.h"
 #include "words.h"
+#include "arena.h"
 
 class JIT
 {
-	bool optimize;
+public:
+	// native entry used by the interpreter, cells holds the inputs on
+	// entry (top of stack last) and receives the outputs on return
+	typedef void (*EntryThunk)(void *function, cell *cells);
+private:
+	typedef std::pair<const llvm::FunctionType *, unsigned> EntryKey;
+	typedef std::map<EntryKey, EntryThunk> EntryThunks;
+
+	unsigned optimize;
+	bool lazy;
+	std::set<llvm::Function *> pending;
+	const llvm::Type *cell_type;
 
 	llvm::Module module;
+	llvm::Module entry_module;
+	EntryThunks entry_thunks;
 	llvm::ExecutionEngine *jit;
 	llvm::ExistingModuleProvider *module_provider;
 	llvm::FunctionPassManager *fpm;
 	llvm::Function *latest;
+	llvm::Function *declared;
 	llvm::BasicBlock *latest_entry;
+	std::vector<llvm::BasicBlock *> blocks;
 	llvm::IRBuilder<> *builder;
-	std::list<llvm::Argument *> inp_args;
-	std::list<llvm::Argument *> out_args;
+	std::vector<llvm::Argument *> inp_args;
+	std::vector<llvm::Value *> outputs;
+	Arena *arena;
 	std::map<std::string, void *> extern_symbols;
+	std::map<std::string, std::string> runtime_symbols;
+	std::vector<std::string> libraries;
+	std::set<llvm::Function *> linked;
+	std::map<llvm::Constant *, llvm::GlobalVariable *> constants;
+
+	struct Definition
+	{
+		llvm::BasicBlock *entry;
+		llvm::BasicBlock *block;
+		llvm::Function *declared;
+		std::vector<llvm::BasicBlock *> blocks;
+		std::vector<llvm::Argument *> inp_args;
+		std::vector<llvm::Value *> outputs;
+	};
+	std::vector<Definition> suspended;
+
+	void CreateReturn(llvm::BasicBlock *block, const std::vector<llvm::Value *> &values, const llvm::Type *ret_type);
 
 	JIT();
 public:
 	static JIT &GetSingleton();
 
-	void SetOptimize(bool optimize) { this->optimize = optimize; }
+	// 0 to 3, the function pipeline runs on every finished word
+	void SetOptimize(unsigned level);
+	unsigned GetOptimize() { return optimize; }
+	void OptimizeModule();
+
+	// lazy words are optimized the first time something reaches them,
+	// machine code is always generated on the first call
+	void SetLazy(bool lazy) { this->lazy = lazy; }
+	void Materialize(llvm::Function *function);
+	size_t GetPendingSize() { return pending.size(); }
+
+	// native output, the entry point makes main a c main
+	void CreateEntryPoint();
+	void EmitAssembly(const std::string &filename, const std::string &cpu);
+	void Partition(unsigned part, unsigned parts);
 
+	// indirection for live redefinition
+	llvm::GlobalVariable *CreateSlot(llvm::Function *function);
+	void PatchSlot(llvm::GlobalVariable *slot, llvm::Function *function);
+
+	const llvm::Type *GetCellType() { return cell_type; }
 	llvm::Module *GetModule() { return &module; }
 	llvm::IRBuilder<> *GetBuilder() { return builder; }
 	llvm::Function *GetLatest() { return latest; }
+	void SetLatest(llvm::Function *function) { latest = function; }
 	llvm::ExecutionEngine *GetExecutionEngine() { return jit; }
 
-	void CreateExternWord(const std::string &word, size_t inputs, size_t outputs);
+	// true when the word is a wrapper converting from stack types
+	bool CreateExternWord(const std::string &word, const std::vector<const llvm::Type *> &inputs, const std::vector<const llvm::Type *> &outputs);
 	void CreateWord();
+	void DeclareWord(const std::string &word, size_t inputs, size_t outputs);
 	void FinishWord(const std::string& word);
+	void DeleteFunction(llvm::Function *function);
+	void ReleaseBody(llvm::Function *function);
+	void SuspendWord();
+	void ResumeWord();
 
-	llvm::Value *CreateInputArgument();
-	llvm::Value *CreateOutputArgument();
+	// placeholder arguments live in the engine's per definition arena
+	void SetArena(Arena *arena) { this->arena = arena; }
+	llvm::Value *CreateInputArgument() { return CreateInputArgument(cell_type); }
+	llvm::Value *CreateInputArgument(const llvm::Type *type);
+	llvm::Value *RetypeArgument(llvm::Value *arg, const llvm::Type *type);
+	void AddOutput(llvm::Value *value);
+	llvm::Value *CreateEntryAlloca(const llvm::Type *type);
+	llvm::Value *InlineCall(llvm::Function *function, const std::vector<llvm::Value *> &arguments);
+	llvm::Value *CreateAddress(llvm::Value *cell, const llvm::Type *type);
+	llvm::BasicBlock *CreateBlock(const std::string &name) { return llvm::BasicBlock::Create(name); }
+	llvm::BasicBlock *GetBlock() { return builder->GetInsertBlock(); }
+	void SetBlock(llvm::BasicBlock *block);
 	size_t GetInputSize() { return inp_args.size(); }
-	size_t GetOutputSize() { return out_args.size(); }
+	size_t GetOutputSize() { return outputs.size(); }
+
+	EntryThunk GetEntryThunk(llvm::Function *function);
+
+	// one global per distinct constant, llvm constants are uniqued
+	llvm::GlobalVariable *InternConstant(llvm::Constant *value);
+	llvm::GlobalVariable *InternString(const std::string &text);
+	bool GetStringLiteral(llvm::Value *address, llvm::Value *size, std::string &text);
 
 	void AddInternalSymbol(const std::string &name, void *address) { extern_symbols[name] = address; }
+	void AddRuntimeSymbol(const std::string &name, const std::string &symbol) { runtime_symbols[name] = symbol; }
 	void *FindSymbol(const std::string &str);
+
+	// shared objects loaded by library, executables link them too
+	void LoadLibrary(const std::string &name);
+	const std::vector<std::string> &GetLibraries() { return libraries; }
+
+	// bitcode definitions for externs, small ones are inlined into words
+	size_t LinkBitcode(const std::string &filename);
+	void InlineLinked(llvm::Function *function);
 };
 
@@ -1,21 +1,117 @@
 #include "lexer.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdlib>
 
-Lexer::Lexer(std::istream &_in) : in(_in)
+static inline bool is_space(char c)
 {
+	return (unsigned char)c <= ' ';
 }
 
-std::string Lexer::NextWord()
+Lexer::Lexer(std::istream &in) : buffer(NULL), mapped_size(0)
 {
-	std::string word;
-	if(!(in >> word))
+	// one bulk read, the stream can't be mapped
+	std::string data;
+	char chunk[65536];
+	while(in.read(chunk, sizeof(chunk)) || in.gcount() > 0)
+		data.append(chunk, in.gcount());
+
+	buffer = (char *)malloc(data.size() + 1);
+	memcpy(buffer, data.data(), data.size());
+	SetBuffer(buffer, data.size());
+}
+
+Lexer::Lexer(const std::string &filename) : buffer(NULL), mapped_size(0)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if(fd < 0)
+		throw std::string("can't open ") + filename;
+
+	struct stat st;
+	if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+	{
+		void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(data != MAP_FAILED)
+		{
+			madvise(data, st.st_size, MADV_SEQUENTIAL);
+			mapped_size = st.st_size;
+			SetBuffer((const char *)data, mapped_size);
+		}
+	}
+
+	// pipes, devices or mmap failure
+	if(mapped_size == 0)
+		ReadFile(fd);
+
+	close(fd);
+}
+
+Lexer::~Lexer()
+{
+	if(mapped_size != 0)
+		munmap((void *)begin, mapped_size);
+	free(buffer);
+}
+
+void Lexer::ReadFile(int fd)
+{
+	size_t size = 0;
+	size_t capacity = 65536;
+	buffer = (char *)malloc(capacity);
+
+	while(true)
+	{
+		if(size == capacity)
+		{
+			capacity *= 2;
+			buffer = (char *)realloc(buffer, capacity);
+		}
+
+		ssize_t n = read(fd, buffer + size, capacity - size);
+		if(n <= 0)
+			break;
+		size += n;
+	}
+
+	SetBuffer(buffer, size);
+}
+
+void Lexer::SetBuffer(const char *data, size_t size)
+{
+	begin = data;
+	end = data + size;
+	pos = data;
+}
+
+Token Lexer::NextWord()
+{
+	// skip whitespace
+	while(pos < end && is_space(*pos))
+		pos++;
+	if(pos == end)
 		throw EndOfStream();
 
+	const char *start = pos;
+	while(pos < end && !is_space(*pos))
+		pos++;
+
+	return Token(start, pos - start);
+}
+
+Token Lexer::PeekWord()
+{
+	const char *saved = pos;
+	Token word = NextWord();
+	pos = saved;
 	return word;
 }
 
-std::string Lexer::NextToken()
+Token Lexer::NextToken()
 {
-	std::string word = NextWord();
+	Token word = NextWord();
 
 	if(word == "\\")
 	{
@@ -36,41 +132,54 @@ std::string Lexer::NextToken()
 		return word;
 }
 
-std::string Lexer::ReadUntil(char u)
+Token Lexer::ReadUntil(char u)
 {
-	std::string word = "";
-
 	// skip whitespace
-	char c = in.get();
-	while(c <= ' ')
-		c = in.get();
+	while(pos < end && is_space(*pos))
+		pos++;
 
 	// read until u
-	while(c != u)
-	{
-		word += c;
-		c = in.get();
-	}
+	const char *start = pos;
+	const char *found = (const char *)memchr(pos, u, end - pos);
+	if(found == NULL)
+		throw EndOfStream();
+	pos = found + 1;
 
-	return word;
+	return Token(start, found - start);
 }
 
-std::string Lexer::ReadLine()
+Token Lexer::ReadLine()
 {
-	std::string line;
-	if(!std::getline(in, line))
+	if(pos == end)
 		throw EndOfStream();
-	else
-		return line;
+
+	const char *start = pos;
+	const char *found = (const char *)memchr(pos, '\n', end - pos);
+	if(found == NULL)
+		found = end;
+	pos = found < end ? found + 1 : end;
+
+	return Token(start, found - start);
 }
 
-void Lexer::Skip(const std::string &close)
+bool Lexer::AtEndOfLine()
 {
-	std::string word;
+	const char *p = pos;
+	while(p < end && *p != '\n' && is_space(*p))
+		p++;
+
+	// a \ comment runs to the end of the line
+	if(p < end && *p == '\\' && (p + 1 == end || is_space(p[1])))
+		return true;
+	return p == end || *p == '\n';
+}
+
+void Lexer::Skip(const char *close)
+{
+	Token word;
 	do
 	{
 		word = NextToken();
 	}
 	while(word != close);
 }
-
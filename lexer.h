@@ -1,6 +1,8 @@
 #pragma once
 
 #include <iostream>
+#include <string>
+#include <cstring>
 
 class EndOfStream : std::exception
 {
@@ -10,17 +12,53 @@ class EndOfStream : std::exception
 	}
 };
 
+// view into the lexer buffer, valid while the lexer lives
+class Token
+{
+	const char *data;
+	size_t size;
+public:
+	Token() : data(NULL), size(0) { }
+	Token(const char *_data, size_t _size) : data(_data), size(_size) { }
+
+	const char *GetData() const { return data; }
+	const char *GetEnd() const { return data + size; }
+	size_t GetSize() const { return size; }
+
+	bool operator==(const char *str) const { return strlen(str) == size && memcmp(data, str, size) == 0; }
+	bool operator!=(const char *str) const { return !(*this == str); }
+	operator std::string() const { return std::string(data, size); }
+};
+
+inline std::ostream &operator<<(std::ostream &out, const Token &token)
+{
+	return out.write(token.GetData(), token.GetSize());
+}
+
 class Lexer
 {
-	std::istream &in;
+	const char *begin;
+	const char *end;
+	const char *pos;
+	char *buffer;
+	size_t mapped_size;
 public:
-	Lexer(std::istream &_in);
+	Lexer(std::istream &in);
+	Lexer(const std::string &filename);
+	~Lexer();
 
-	std::string NextWord();
-	std::string NextToken();
-	std::string ReadUntil(char u);
-	std::string ReadLine();
+	Token NextWord();
+	Token NextToken();
+	Token PeekWord();
+	Token ReadUntil(char u);
+	Token ReadLine();
+	bool AtEndOfLine();
+
+	// read ahead and come back
+	const char *GetPosition() { return pos; }
+	void SetPosition(const char *position) { pos = position; }
 private:
-	void Skip(const std::string &close);
+	void Skip(const char *close);
+	void ReadFile(int fd);
+	void SetBuffer(const char *data, size_t size);
 };
-
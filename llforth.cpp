@@ -1,6 +1,10 @@
 #include <iostream>
 #include <fstream>
+#include <cstdlib>
 #include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sstream>
 #include <llvm/PassManager.h>
 #include <llvm/CodeGen/Passes.h>
 #include <llvm/LinkAllPasses.h>
@@ -16,21 +20,54 @@
 static bool verbose = false;
 static std::string input_filename("");
 static std::string output_filename("");
-static bool optimize = false;
+static std::string output_format("bc");
+static std::string cpu("");
+static const char *cc = "cc";
+static unsigned jobs = 1;
+static unsigned optimize = 0;
+static size_t stack_size = 65536;
+static bool batch = false;
+static unsigned threshold = 0;
+static bool lazy = false;
+static std::string cache_directory("");
+static bool live = false;
+static std::vector<std::string> bitcode_files;
+
+// host words of compiled executables, the makefile passes the full path
+#ifndef LLFORTH_RUNTIME
+#define LLFORTH_RUNTIME "runtime.o"
+#endif
 
 extern void kk()
 {
 	printf("KAKA\n");
 }
 
+static double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
 void show_help()
 {
 	std::cout << "llforth [OPTIONS]..." << std::endl << std::endl;
 	std::cout << "  -h         	show help" << std::endl;
 	std::cout << "  -v         	verbose output" << std::endl;
-	std::cout << "  -o filename	object filename" << std::endl;
-	std::cout << "  -O         	run optimize passes" << std::endl;
+	std::cout << "  -o filename	output filename" << std::endl;
+	std::cout << "  -f format  	output format: bc, asm, obj or exe" << std::endl;
+	std::cout << "  -m cpu     	target cpu of native output" << std::endl;
+	std::cout << "  -j jobs    	compile objects and executables in this many processes" << std::endl;
+	std::cout << "  -O[level]  	optimize level 0 to 3, -O is -O2" << std::endl;
 	std::cout << "  -i         	input filename" << std::endl;
+	std::cout << "  -s cells   	data stack size" << std::endl;
+	std::cout << "  -l         	compile top-level code a line at a time" << std::endl;
+	std::cout << "  -t calls   	run words threaded until called this many times" << std::endl;
+	std::cout << "  -L         	optimize words on their first call" << std::endl;
+	std::cout << "  -C dir     	cache compiled definitions in this directory" << std::endl;
+	std::cout << "  -r         	live mode, redefinitions replace the word in its callers" << std::endl;
+	std::cout << "  -b file.bc 	link llvm bitcode for externs, may be repeated" << std::endl;
 	exit(0);
 }
 
@@ -40,7 +77,7 @@ void read_args(int argc, char **argv)
 	extern char *optarg;
 	extern int optopt;
 
-	while((c = getopt(argc, argv, "vho:Oi:")) != -1)
+	while((c = getopt(argc, argv, "vho:f:m:j:O::i:s:lt:LC:rb:")) != -1)
 		switch(c)
 		{
 		case 'h':
@@ -52,72 +89,250 @@ void read_args(int argc, char **argv)
 		case 'o':
 			output_filename = optarg;
 			break;
+		case 'f':
+			output_format = optarg;
+			break;
+		case 'm':
+			cpu = optarg;
+			break;
+		case 'j':
+			jobs = atoi(optarg) > 0 ? atoi(optarg) : 1;
+			break;
 		case 'O':
-			optimize = true;
+			optimize = optarg != NULL ? atoi(optarg) : 2;
+			if(optimize > 3)
+				optimize = 3;
 			break;
 		case 'i':
 			input_filename = optarg;
 			break;
+		case 's':
+			stack_size = atoi(optarg);
+			break;
+		case 'l':
+			batch = true;
+			break;
+		case 't':
+			threshold = atoi(optarg);
+			break;
+		case 'L':
+			lazy = true;
+			break;
+		case 'C':
+			cache_directory = optarg;
+			break;
+		case 'r':
+			live = true;
+			break;
+		case 'b':
+			bitcode_files.push_back(optarg);
+			break;
 		case '?':
 			std::cerr << "Unknown option -" << (char)optopt << std::endl;
 		}
 }
 
-void compile(std::istream &in)
+static void run(const std::string &command)
 {
-	JIT::GetSingleton().SetOptimize(optimize);
-	Engine &e = Engine::GetSingleton();
-	e.SetInputStream(in);
-	e.SetVerbose(verbose);
-	e.MainLoop();
+	if(verbose)
+		std::cerr << command << std::endl;
+	if(system(command.c_str()) != 0)
+		throw std::string("failed: ") + command;
+}
 
-	if(output_filename != "")
+static std::string quote(const std::string &filename)
+{
+	return "'" + filename + "'";
+}
+
+static void write_object(const std::string &object)
+{
+	// the target machine writes assembly, the system assembler finishes it
+	JIT &jit = JIT::GetSingleton();
+	std::string assembly = object + ".s";
+	jit.EmitAssembly(assembly, cpu);
+	try
+	{
+		run(std::string(cc) + " -c " + quote(assembly) + " -o " + quote(object));
+	}
+	catch(std::string &)
 	{
-		llvm::Module *module = JIT::GetSingleton().GetModule();
+		unlink(assembly.c_str());
+		throw;
+	}
+	unlink(assembly.c_str());
+}
 
-		if(optimize)
+static void write_parts(std::vector<std::string> &objects)
+{
+	// llvm 2.5 has no per thread context, each worker process optimizes
+	// and compiles its share of the words
+	std::vector<pid_t> workers;
+	for(unsigned i = 0; i < jobs; i++)
+	{
+		std::ostringstream object;
+		object << output_filename << "." << i << ".o";
+		objects.push_back(object.str());
+
+		pid_t pid = fork();
+		if(pid < 0)
+			throw std::string("can't fork");
+		if(pid == 0)
 		{
-			llvm::PassManager pm;
-			pm.add(new llvm::TargetData(module));
-			pm.add(llvm::createIPSCCPPass());
-			pm.add(llvm::createGlobalOptimizerPass());
-//			pm.add(llvm::createInstructionCombiningPass()); doesn't works well with CallingConv::Fast
-			pm.add(llvm::createFunctionInliningPass());
-			pm.add(llvm::createGlobalOptimizerPass());
-			pm.add(llvm::createInstructionCombiningPass());
-			pm.add(llvm::createGVNPass());
-			pm.add(llvm::createPromoteMemoryToRegisterPass());
-			pm.add(llvm::createCFGSimplificationPass());
-			pm.add(llvm::createDeadArgEliminationPass());
-			pm.add(llvm::createDeadCodeEliminationPass());
-			pm.add(llvm::createDeadInstEliminationPass());
-			pm.add(llvm::createDeadStoreEliminationPass());
-			pm.add(llvm::createDeadTypeEliminationPass());
-			pm.run(*module);
+			int status = 0;
+			try
+			{
+				JIT::GetSingleton().Partition(i, jobs);
+				JIT::GetSingleton().OptimizeModule();
+				write_object(objects.back());
+			}
+			catch(std::string &error)
+			{
+				std::cout << "Exception: " << error << std::endl;
+				status = 1;
+			}
+			_exit(status);
 		}
+		workers.push_back(pid);
+	}
 
+	bool failed = false;
+	for(size_t i = 0; i < workers.size(); i++)
+	{
+		int status;
+		if(waitpid(workers[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			failed = true;
+	}
+	if(failed)
+	{
+		for(size_t i = 0; i < objects.size(); i++)
+			unlink(objects[i].c_str());
+		throw std::string("compile worker failed");
+	}
+}
+
+static void write_output()
+{
+	JIT &jit = JIT::GetSingleton();
+	llvm::Module *module = jit.GetModule();
+	if(output_format != "bc" && output_format != "asm" && output_format != "obj" && output_format != "exe")
+		throw std::string("unknown output format ") + output_format;
+	if(output_format == "exe")
+		jit.CreateEntryPoint();
+
+	double start = now();
+	std::vector<std::string> objects;
+	if(jobs > 1 && output_format != "bc" && output_format != "asm")
+		write_parts(objects);
+	else
+	{
+		// calls carry their callee's calling convention, so instcombine
+		// is safe with CallingConv::Fast
+		jit.OptimizeModule();
+		if(verbose)
+			std::cerr << "module: -O" << optimize << " in " << now() - start << "s" << std::endl;
 		if(verbose)
 			module->dump();
 
-		// save object file
-		std::ofstream of(output_filename.c_str(), std::ios::binary);
-		llvm::WriteBitcodeToFile(module, of);
-		of.close();
+		if(output_format == "bc")
+		{
+			std::ofstream of(output_filename.c_str(), std::ios::binary);
+			llvm::WriteBitcodeToFile(module, of);
+			of.close();
+			return;
+		}
+		if(output_format == "asm")
+		{
+			jit.EmitAssembly(output_filename, cpu);
+			return;
+		}
+		if(output_format == "obj")
+		{
+			write_object(output_filename);
+			return;
+		}
+		objects.push_back(output_filename + ".o");
+		write_object(objects.back());
+	}
+	if(verbose)
+		std::cerr << "codegen: " << objects.size() << " objects in " << now() - start << "s" << std::endl;
+
+	std::string files;
+	for(size_t i = 0; i < objects.size(); i++)
+		files += " " + quote(objects[i]);
+
+	// libraries loaded by the source, by path or by soname
+	std::string libraries;
+	const std::vector<std::string> &loaded = jit.GetLibraries();
+	for(size_t i = 0; i < loaded.size(); i++)
+		libraries += " " + (loaded[i].find('/') != std::string::npos ? quote(loaded[i]) : quote("-l:" + loaded[i]));
+	try
+	{
+		// parts of an object are linked into one relocatable object
+		if(output_format == "obj")
+			run("ld -r" + files + " -o " + quote(output_filename));
+		else
+			run(std::string(cc) + files + " " + LLFORTH_RUNTIME + libraries + " -o " + quote(output_filename));
+	}
+	catch(std::string &)
+	{
+		for(size_t i = 0; i < objects.size(); i++)
+			unlink(objects[i].c_str());
+		throw;
 	}
+	for(size_t i = 0; i < objects.size(); i++)
+		unlink(objects[i].c_str());
+}
+
+void compile()
+{
+	JIT::GetSingleton().SetOptimize(optimize);
+	// with -j the workers run the function passes on their own words,
+	// the front end only optimizes what it runs
+	bool parallel = jobs > 1 && output_filename != "" && output_format != "bc" && output_format != "asm";
+	JIT::GetSingleton().SetLazy(lazy || parallel);
+	for(size_t i = 0; i < bitcode_files.size(); i++)
+	{
+		size_t functions = JIT::GetSingleton().LinkBitcode(bitcode_files[i]);
+		if(verbose)
+			std::cerr << "bitcode: " << functions << " functions from " << bitcode_files[i] << std::endl;
+	}
+	Engine &e = Engine::GetSingleton();
+	e.runtime_stack.Resize(stack_size);
+	if(input_filename.size() != 0)
+		e.SetInputFile(input_filename);
+	else
+		e.SetInputStream(std::cin);
+	e.SetVerbose(verbose);
+	e.SetBatch(batch);
+	e.SetThreshold(threshold);
+	e.SetLive(live);
+	e.SetRelease(output_filename == "" && !lazy && !live);
+	if(cache_directory != "")
+	{
+		// words may inline the helpers, new bitcode is a new key
+		Cache *cache = new Cache(cache_directory);
+		for(size_t i = 0; i < bitcode_files.size(); i++)
+			cache->AddFile(bitcode_files[i]);
+		e.SetCache(cache);
+	}
+	e.MainLoop();
+
+	if(verbose)
+		e.PrintStatistics();
+
+	if(output_filename != "")
+		write_output();
 }
 
 int main(int argc, char **argv)
 {
 	read_args(argc, argv);
+	if(getenv("CC") != NULL)
+		cc = getenv("CC");
 	try
 	{
-		if(input_filename.size() != 0)
-		{
-			std::ifstream is(input_filename.c_str());
-			compile(is);
-		}
-		else
-			compile(std::cin);
+		compile();
 		return 0;
 	}
 	catch(std::string &error)
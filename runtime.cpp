@@ -0,0 +1,44 @@
+#include "runtime.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/time.h>
+
+// no llvm or engine in here, executables link this file alone
+
+void word_dot(cell value)
+{
+	printf("%lld ", (long long)value);
+}
+
+void word_fdot(double value)
+{
+	printf("%g ", value);
+}
+
+cell word_utime()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (cell)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+cell word_compare(cell u2, cell a2, cell u1, cell a1)
+{
+	// arguments come from the top of the stack
+	int order = memcmp((const void *)a1, (const void *)a2, u1 < u2 ? u1 : u2);
+	if(order == 0)
+		return u1 < u2 ? -1 : u1 > u2 ? 1 : 0;
+	return order < 0 ? -1 : 1;
+}
+
+void word_concat(cell u2, cell a2, cell u1, cell a1, cell *address, cell *size)
+{
+	// a new string each time, zero terminated like the literals
+	char *text = (char *)malloc(u1 + u2 + 1);
+	memcpy(text, (const void *)a1, u1);
+	memcpy(text + u1, (const void *)a2, u2);
+	text[u1 + u2] = 0;
+	*address = (cell)text;
+	*size = u1 + u2;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "stack.h"
+
+// host words compiled code calls at run time, they are linked into
+// executables so they keep their c names
+extern "C"
+{
+	void word_dot(cell value);
+	void word_fdot(double value);
+	cell word_utime();
+	cell word_compare(cell u2, cell a2, cell u1, cell a1);
+	void word_concat(cell u2, cell a2, cell u1, cell a1, cell *address, cell *size);
+}
@@ -0,0 +1,40 @@
+#include "stack.h"
+#include <sys/mman.h>
+#include <unistd.h>
+
+DataStack::DataStack(size_t capacity) : base(NULL), capacity(0), depth(0), mapped(NULL), mapped_size(0)
+{
+	Resize(capacity);
+}
+
+DataStack::~DataStack()
+{
+	if(mapped != NULL)
+		munmap(mapped, mapped_size);
+}
+
+void DataStack::Resize(size_t capacity)
+{
+	if(depth != 0)
+		throw std::string("can't resize a non empty stack");
+
+	if(mapped != NULL)
+		munmap(mapped, mapped_size);
+
+	// cells between two guard pages, the capacity rounds up to whole pages
+	// so both guards touch the cells
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t size = (capacity * sizeof(cell) + page - 1) / page * page;
+	mapped_size = size + 2 * page;
+	mapped = (char *)mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(mapped == MAP_FAILED)
+	{
+		mapped = NULL;
+		throw std::string("can't allocate stack");
+	}
+	mprotect(mapped, page, PROT_NONE);
+	mprotect(mapped + page + size, page, PROT_NONE);
+
+	base = (cell *)(mapped + page);
+	this->capacity = size / sizeof(cell);
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <stdint.h>
+
+// the single place that sets the cell width, the host pointer width
+// unless built with -DCELL_BITS=32 or 64
+#if !defined(CELL_BITS)
+typedef intptr_t cell;
+#elif CELL_BITS == 32
+typedef int32_t cell;
+#elif CELL_BITS == 64
+typedef int64_t cell;
+#else
+#error "CELL_BITS must be 32 or 64"
+#endif
+
+// the interpreter keeps floats in cells by their bits, narrowed to a
+// float when a cell can't hold a double
+inline cell FloatToCell(double value)
+{
+	cell bits = 0;
+	if(sizeof(cell) >= sizeof(double))
+		memcpy(&bits, &value, sizeof(double));
+	else
+	{
+		float narrow = value;
+		memcpy(&bits, &narrow, sizeof(float));
+	}
+	return bits;
+}
+
+inline double CellToFloat(cell bits)
+{
+	if(sizeof(cell) >= sizeof(double))
+	{
+		double value;
+		memcpy(&value, &bits, sizeof(double));
+		return value;
+	}
+	float narrow;
+	memcpy(&narrow, &bits, sizeof(float));
+	return narrow;
+}
+
+class DataStack
+{
+	cell *base;
+	size_t capacity;
+	size_t depth;
+	char *mapped;
+	size_t mapped_size;
+public:
+	DataStack(size_t capacity);
+	~DataStack();
+
+	void Resize(size_t capacity);
+	size_t GetCapacity() { return capacity; }
+	size_t GetDepth() { return depth; }
+	cell *GetBase() { return base; }
+
+	void Push(cell value)
+	{
+		if(depth == capacity)
+			throw std::string("stack overflow");
+		base[depth++] = value;
+	}
+
+	cell Pop()
+	{
+		if(depth == 0)
+			throw std::string("stack underflow");
+		return base[--depth];
+	}
+
+	// cells used in place by a call of inputs -- outputs
+	cell *Enter(size_t inputs, size_t outputs)
+	{
+		if(depth < inputs)
+			throw std::string("stack underflow");
+		if(depth - inputs + outputs > capacity)
+			throw std::string("stack overflow");
+		return base + depth - inputs;
+	}
+
+	void Leave(size_t inputs, size_t outputs)
+	{
+		depth = depth - inputs + outputs;
+	}
+};
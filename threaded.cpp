@@ -0,0 +1,70 @@
+#include "threaded.h"
+#include "word.h"
+
+ThreadedCode::ThreadedCode() : threaded(false), depth(0), min_depth(0), invocations(0)
+{
+}
+
+void ThreadedCode::AddLiteral(cell literal)
+{
+	Instruction i;
+	i.code = NULL;
+	i.kind = LITERAL;
+	i.literal = literal;
+	code.push_back(i);
+
+	depth++;
+}
+
+void ThreadedCode::AddCall(Word *word, size_t inputs, size_t outputs)
+{
+	Instruction i;
+	i.code = NULL;
+	i.kind = CALL;
+	i.word = word;
+	code.push_back(i);
+
+	// track the stack effect
+	depth -= inputs;
+	if(depth < min_depth)
+		min_depth = depth;
+	depth += outputs;
+}
+
+void ThreadedCode::Finish()
+{
+	Instruction i;
+	i.code = NULL;
+	i.kind = EXIT;
+	i.word = NULL;
+	code.push_back(i);
+}
+
+void ThreadedCode::Run(DataStack &stack)
+{
+	static const void *handlers[] = { &&literal, &&call, &&exit };
+
+	// resolve handler addresses on first run
+	if(!threaded)
+	{
+		for(size_t i = 0; i < code.size(); i++)
+			code[i].code = handlers[code[i].kind];
+		threaded = true;
+	}
+
+	const Instruction *ip = &code[0];
+	goto *ip->code;
+
+literal:
+	stack.Push(ip->literal);
+	ip++;
+	goto *ip->code;
+
+call:
+	ip->word->Execute(NULL);
+	ip++;
+	goto *ip->code;
+
+exit:
+	return;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include "stack.h"
+
+class Word;
+
+// baseline tier, direct threaded code over the data stack
+class ThreadedCode
+{
+public:
+	enum Kind { LITERAL, CALL, EXIT };
+private:
+	struct Instruction
+	{
+		const void *code;
+		Kind kind;
+		union
+		{
+			cell literal;
+			Word *word;
+		};
+	};
+
+	std::vector<Instruction> code;
+	bool threaded;
+	long depth;
+	long min_depth;
+	unsigned invocations;
+public:
+	ThreadedCode();
+
+	void AddLiteral(cell literal);
+	void AddCall(Word *word, size_t inputs, size_t outputs);
+	void Finish();
+
+	size_t GetInputSize() { return -min_depth; }
+	size_t GetOutputSize() { return depth - min_depth; }
+	unsigned Count() { return ++invocations; }
+
+	size_t GetSize() { return code.size(); }
+	Kind GetKind(size_t index) { return code[index].kind; }
+	cell GetLiteral(size_t index) { return code[index].literal; }
+	Word *GetWord(size_t index) { return code[index].word; }
+
+	void Run(DataStack &stack);
+};
@@ -0,0 +1,218 @@
+#include "vector.h"
+#include "jit.h"
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+// counted loop for(index = start; index < end; index += step)
+struct VectorLoop
+{
+	llvm::BasicBlock *preheader;
+	llvm::BasicBlock *header;
+	llvm::BasicBlock *exit;
+	llvm::PHINode *index;
+	unsigned step;
+};
+
+unsigned GetVectorBytes()
+{
+	// widest simd unit of the host, the backend splits what it can't select
+	static unsigned bytes = 0;
+	if(bytes != 0)
+		return bytes;
+
+	bytes = 16;
+#if defined(__i386__) || defined(__x86_64__)
+	unsigned eax, ebx, ecx, edx;
+	if(__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+	{
+		if((ecx & bit_AVX) && (ecx & bit_OSXSAVE))
+			bytes = 32;
+		else if(!(edx & bit_SSE2))
+			bytes = sizeof(cell);
+	}
+#endif
+	return bytes;
+}
+
+static void StartLoop(VectorLoop &loop, llvm::Value *start, llvm::Value *end, unsigned step)
+{
+	JIT &jit = JIT::GetSingleton();
+	llvm::IRBuilder<> *builder = jit.GetBuilder();
+
+	loop.preheader = jit.GetBlock();
+	loop.header = jit.CreateBlock("vloop");
+	loop.exit = jit.CreateBlock("vexit");
+	loop.step = step;
+	llvm::BasicBlock *body = jit.CreateBlock("vbody");
+
+	builder->CreateBr(loop.header);
+	jit.SetBlock(loop.header);
+	loop.index = builder->CreatePHI(start->getType());
+	loop.index->addIncoming(start, loop.preheader);
+	builder->CreateCondBr(builder->CreateICmpSLT(loop.index, end), body, loop.exit);
+	jit.SetBlock(body);
+}
+
+static llvm::PHINode *AddLoopValue(VectorLoop &loop, llvm::Value *start)
+{
+	llvm::PHINode *phi = llvm::PHINode::Create(start->getType(), "", &loop.header->front());
+	phi->addIncoming(start, loop.preheader);
+	return phi;
+}
+
+static void FinishLoop(VectorLoop &loop)
+{
+	JIT &jit = JIT::GetSingleton();
+	llvm::IRBuilder<> *builder = jit.GetBuilder();
+
+	llvm::Value *next = builder->CreateAdd(loop.index, llvm::ConstantInt::get(loop.index->getType(), loop.step));
+	loop.index->addIncoming(next, jit.GetBlock());
+	builder->CreateBr(loop.header);
+	jit.SetBlock(loop.exit);
+}
+
+static llvm::Value *GetAddress(llvm::Value *base, const llvm::Type *type, llvm::Value *index)
+{
+	// index counts elements, the vector pointer starts at the same place
+	llvm::IRBuilder<> *builder = JIT::GetSingleton().GetBuilder();
+	const llvm::Type *element = type;
+	if(const llvm::VectorType *vtype = llvm::dyn_cast<llvm::VectorType>(type))
+		element = vtype->getElementType();
+
+	llvm::Value *pointer = builder->CreateGEP(JIT::GetSingleton().CreateAddress(base, llvm::PointerType::getUnqual(element)), index);
+	if(element != type)
+		pointer = builder->CreateBitCast(pointer, llvm::PointerType::getUnqual(type));
+	return pointer;
+}
+
+static unsigned GetAlignment(const llvm::Type *type)
+{
+	// arrays only promise element alignment
+	if(const llvm::VectorType *vtype = llvm::dyn_cast<llvm::VectorType>(type))
+		type = vtype->getElementType();
+	return type->getPrimitiveSizeInBits() / 8;
+}
+
+static llvm::Value *Load(llvm::Value *base, const llvm::Type *type, llvm::Value *index)
+{
+	llvm::LoadInst *load = JIT::GetSingleton().GetBuilder()->CreateLoad(GetAddress(base, type, index));
+	load->setAlignment(GetAlignment(type));
+	return load;
+}
+
+static void Store(llvm::Value *value, llvm::Value *base, llvm::Value *index)
+{
+	llvm::StoreInst *store = JIT::GetSingleton().GetBuilder()->CreateStore(value, GetAddress(base, value->getType(), index));
+	store->setAlignment(GetAlignment(value->getType()));
+}
+
+static llvm::Value *Apply(llvm::IRBuilder<> *builder, VectorOp op, const std::vector<llvm::Value *> &sources, const llvm::Type *type, llvm::Value *index)
+{
+	llvm::Value *a = Load(sources[0], type, index);
+	if(sources.size() == 1)
+		return a;
+	llvm::Value *c = sources.size() > 2 ? Load(sources[2], type, index) : NULL;
+	return op(builder, a, Load(sources[1], type, index), c);
+}
+
+static unsigned GetLanes(const llvm::Type *element)
+{
+	unsigned lanes = GetVectorBytes() / GetAlignment(element);
+	return lanes > 0 ? lanes : 1;
+}
+
+void EmitVectorMap(const llvm::Type *element, const std::vector<llvm::Value *> &sources, llvm::Value *dest, llvm::Value *n, VectorOp op)
+{
+	llvm::IRBuilder<> *builder = JIT::GetSingleton().GetBuilder();
+	unsigned lanes = GetLanes(element);
+	const llvm::Type *vector = llvm::VectorType::get(element, lanes);
+	llvm::Value *zero = llvm::Constant::getNullValue(n->getType());
+
+	// whole vectors first, then the elements left
+	llvm::Value *vn = builder->CreateAnd(n, llvm::ConstantInt::get(n->getType(), -(int64_t)lanes, true));
+	VectorLoop loop;
+	StartLoop(loop, zero, vn, lanes);
+	Store(Apply(builder, op, sources, vector, loop.index), dest, loop.index);
+	FinishLoop(loop);
+
+	StartLoop(loop, vn, n, 1);
+	Store(Apply(builder, op, sources, element, loop.index), dest, loop.index);
+	FinishLoop(loop);
+}
+
+llvm::Value *EmitVectorSum(const llvm::Type *element, const std::vector<llvm::Value *> &sources, llvm::Value *n, VectorOp map)
+{
+	llvm::IRBuilder<> *builder = JIT::GetSingleton().GetBuilder();
+	unsigned lanes = GetLanes(element);
+	const llvm::Type *vector = llvm::VectorType::get(element, lanes);
+	llvm::Value *zero = llvm::Constant::getNullValue(n->getType());
+
+	// one partial sum per lane
+	llvm::Value *vn = builder->CreateAnd(n, llvm::ConstantInt::get(n->getType(), -(int64_t)lanes, true));
+	VectorLoop loop;
+	StartLoop(loop, zero, vn, lanes);
+	llvm::PHINode *partial = AddLoopValue(loop, llvm::Constant::getNullValue(vector));
+	llvm::Value *next = builder->CreateAdd(partial, Apply(builder, map, sources, vector, loop.index));
+	partial->addIncoming(next, JIT::GetSingleton().GetBlock());
+	FinishLoop(loop);
+
+	// add the lanes, then the elements left
+	llvm::Value *sum = builder->CreateExtractElement(partial, llvm::ConstantInt::get(llvm::Type::Int32Ty, 0));
+	for(unsigned i = 1; i < lanes; i++)
+		sum = builder->CreateAdd(sum, builder->CreateExtractElement(partial, llvm::ConstantInt::get(llvm::Type::Int32Ty, i)));
+
+	StartLoop(loop, vn, n, 1);
+	llvm::PHINode *total = AddLoopValue(loop, sum);
+	next = builder->CreateAdd(total, Apply(builder, map, sources, element, loop.index));
+	total->addIncoming(next, JIT::GetSingleton().GetBlock());
+	FinishLoop(loop);
+
+	return total;
+}
+
+llvm::Value *VectorAdd(llvm::IRBuilder<> *builder, llvm::Value *a, llvm::Value *b, llvm::Value *c)
+{
+	return builder->CreateAdd(a, b);
+}
+
+llvm::Value *VectorSub(llvm::IRBuilder<> *builder, llvm::Value *a, llvm::Value *b, llvm::Value *c)
+{
+	return builder->CreateSub(a, b);
+}
+
+llvm::Value *VectorMul(llvm::IRBuilder<> *builder, llvm::Value *a, llvm::Value *b, llvm::Value *c)
+{
+	return builder->CreateMul(a, b);
+}
+
+llvm::Value *VectorMulAdd(llvm::IRBuilder<> *builder, llvm::Value *a, llvm::Value *b, llvm::Value *c)
+{
+	// no fused multiply add in this llvm, the backend keeps it in registers
+	return builder->CreateAdd(builder->CreateMul(a, b), c);
+}
+
+llvm::Value *VectorMax(llvm::IRBuilder<> *builder, llvm::Value *a, llvm::Value *b, llvm::Value *c)
+{
+	const llvm::Type *type = a->getType();
+	const llvm::VectorType *vtype = llvm::dyn_cast<llvm::VectorType>(type);
+	if(vtype == NULL)
+	{
+		llvm::Value *greater = type->isFloatingPoint() ? builder->CreateFCmpOGT(a, b) : builder->CreateICmpSGT(a, b);
+		return builder->CreateSelect(greater, a, b);
+	}
+
+	// vector compares give a lane mask, select through it
+	llvm::Value *mask;
+	if(type->isFPOrFPVector())
+	{
+		mask = builder->CreateVFCmp(llvm::FCmpInst::FCMP_OGT, a, b);
+		const llvm::Type *itype = mask->getType();
+		llvm::Value *ia = builder->CreateBitCast(a, itype);
+		llvm::Value *ib = builder->CreateBitCast(b, itype);
+		llvm::Value *max = builder->CreateOr(builder->CreateAnd(mask, ia), builder->CreateAnd(builder->CreateNot(mask), ib));
+		return builder->CreateBitCast(max, type);
+	}
+	mask = builder->CreateVICmp(llvm::ICmpInst::ICMP_SGT, a, b);
+	return builder->CreateOr(builder->CreateAnd(mask, a), builder->CreateAnd(builder->CreateNot(mask), b));
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <vector>
+#include <llvm/Support/IRBuilder.h>
+
+// element operation, called with vectors in the vector loop and with
+// scalars in the tail
+typedef llvm::Value *(*VectorOp)(llvm::IRBuilder<> *builder, llvm::Value *a, llvm::Value *b, llvm::Value *c);
+
+unsigned GetVectorBytes();
+
+// dest[i] = op(sources[0][i], sources[1][i], sources[2][i]) for i < n,
+// addresses are cells and c is NULL with two sources
+void EmitVectorMap(const llvm::Type *element, const std::vector<llvm::Value *> &sources, llvm::Value *dest, llvm::Value *n, VectorOp op);
+
+// sum of map(sources[0][i], sources[1][i]), or of sources[0][i] when map is NULL
+llvm::Value *EmitVectorSum(const llvm::Type *element, const std::vector<llvm::Value *> &sources, llvm::Value *n, VectorOp map);
+
+llvm::Value *VectorAdd(llvm::IRBuilder<> *builder, llvm::Value *a, llvm::Value *b, llvm::Value *c);
+llvm::Value *VectorSub(llvm::IRBuilder<> *builder, llvm::Value *a, llvm::Value *b, llvm::Value *c);
+llvm::Value *VectorMul(llvm::IRBuilder<> *builder, llvm::Value *a, llvm::Value *b, llvm::Value *c);
+llvm::Value *VectorMulAdd(llvm::IRBuilder<> *builder, llvm::Value *a, llvm::Value *b, llvm::Value *c);
+llvm::Value *VectorMax(llvm::IRBuilder<> *builder, llvm::Value *a, llvm::Value *b, llvm::Value *c);
@@ -1,6 +1,7 @@
 #include "word.h"
+#include <cstring>
 
-WordInstance::WordInstance(Word *_word) : word(_word)
+WordInstance::WordInstance(Arena &_arena, Word *_word) : arena(_arena), word(_word), outputs(NULL), size(0), capacity(0)
 {
 	assert(word != NULL);
 }
@@ -12,15 +13,26 @@ Word *WordInstance::GetWord()
 
 void WordInstance::SetOutput(size_t index, llvm::Value *output)
 {
-	assert(index >= 0);
-	if(outputs.size() <= index)
-		outputs.resize(index + 1);
+	if(capacity <= index)
+	{
+		// grow inside the arena, the old array is dropped with it
+		size_t new_capacity = capacity == 0 ? 4 : capacity * 2;
+		while(new_capacity <= index)
+			new_capacity *= 2;
+		llvm::Value **new_outputs = (llvm::Value **)arena.Allocate(new_capacity * sizeof(llvm::Value *));
+		memcpy(new_outputs, outputs, size * sizeof(llvm::Value *));
+		outputs = new_outputs;
+		capacity = new_capacity;
+	}
+
+	for(; size <= index; size++)
+		outputs[size] = NULL;
 	outputs[index] = output;
 }
 
 llvm::Value *WordInstance::GetOutput(size_t index)
 {
-	assert(index >= 0 && index < GetOutputSize());
+	assert(index < GetOutputSize());
 	return outputs[index];
 }
 
@@ -49,4 +61,3 @@ llvm::Value *WordIndex::GetOutput()
 {
 	return word_instance->GetOutput(index);
 }
-
@@ -1,8 +1,9 @@
 #pragma once
 
 #include <iostream>
+#include <stdint.h>
 #include <llvm/Function.h>
-#include <vector>
+#include "arena.h"
 
 class Engine;
 class WordIndex;
@@ -10,17 +11,19 @@ class Word;
 
 class WordInstance
 {
+	Arena &arena;
 	Word *word;
-	std::vector<llvm::Value *> outputs;
+	llvm::Value **outputs;
+	size_t size;
+	size_t capacity;
 public:
-	WordInstance(Word *_word);
-	~WordInstance();
+	WordInstance(Arena &_arena, Word *_word);
 
 	Word *GetWord();
 	
 	void SetOutput(size_t index, llvm::Value *output);
 	llvm::Value *GetOutput(size_t index);
-	size_t GetOutputSize() { return outputs.size(); }
+	size_t GetOutputSize() { return size; }
 
 	void Compile();
 };
@@ -29,14 +32,26 @@ class Word
 {
 	bool immediate;
 	bool hidden;
+	bool batchable;
+	Word *link;
 public:
-	Word() : immediate(false), hidden(false) { }
+	Word() : immediate(false), hidden(false), batchable(true), link(NULL) { }
 
 	virtual std::string GetName() = 0;
 	bool IsImmediate() { return immediate; }
 	bool IsHidden() { return hidden; }
 	void SetImmediate(bool immediate) { this->immediate = immediate; }
 	void SetHidden(bool hidden) { this->hidden = hidden; }
+	virtual bool IsBatchable() { return batchable; }
+	void SetBatchable(bool batchable) { this->batchable = batchable; }
+	Word *GetLink() { return link; }
+	void SetLink(Word *link) { this->link = link; }
+
+	// fixed number of inputs and outputs, known before compiling
+	virtual bool GetStackEffect(size_t &inputs, size_t &outputs) { return false; }
+
+	// hash of the source of colon definitions, 0 for the rest
+	virtual uint64_t GetSourceKey() { return 0; }
 
 	virtual void Execute(WordInstance *instance) = 0;
 };
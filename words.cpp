@@ -1,114 +1,263 @@
 #include <sstream>
 #include <iostream>
-#include <llvm/ExecutionEngine/GenericValue.h>
+#include <algorithm>
 #include "words.h"
 #include "engine.h"
 #include "jit.h"
 
-FunctionWord::FunctionWord() : function(NULL), inputs(0), outputs(0)
+FunctionWord::FunctionWord() : function(NULL), threaded(NULL), native(NULL), entry(NULL), name(""), inputs(0), outputs(0), inlined(false), source_key(0), slot(NULL), source(NULL)
 {
 }
 
+void FunctionWord::AddUser(FunctionWord *user)
+{
+	if(std::find(users.begin(), users.end(), user) == users.end())
+		users.push_back(user);
+}
+
+bool FunctionWord::GetStackEffect(size_t &inputs, size_t &outputs)
+{
+	inputs = this->inputs;
+	outputs = this->outputs;
+	return true;
+}
+
 void FunctionWord::Execute(WordInstance *instance)
 {
 	Engine &e = Engine::GetSingleton();
 
-	size_t real_outputs;
-	const llvm::FunctionType *ftype = function->getFunctionType();
-	if(ftype->getReturnType() != llvm::Type::VoidTy)
-		real_outputs = outputs - 1;
-	else
-		real_outputs = outputs;
+	if(threaded != NULL)
+	{
+		// stay in the baseline tier until hot, compiled callers need llvm code
+		if(instance == NULL && threaded->Count() < e.GetThreshold())
+		{
+			threaded->Run(e.runtime_stack);
+			return;
+		}
+		e.Promote(this);
+	}
 
 	if(instance == NULL)
 	{
-		// setup inputs
-		std::vector<llvm::GenericValue> arguments(inputs + real_outputs);
-		for(size_t i = 0; i < inputs; i++)
+		if(entry == NULL)
 		{
-			int number = e.runtime_stack.front();
-			arguments[i].IntVal = llvm::APInt(32, number);
-			e.runtime_stack.pop_front();
+			JIT::GetSingleton().Materialize(function);
+			entry = JIT::GetSingleton().GetEntryThunk(function);
+			native = JIT::GetSingleton().GetExecutionEngine()->getPointerToFunction(function);
 		}
 
-		// setup outputs
-		int outs[real_outputs];
-		for(size_t i = 0; i < real_outputs; i++)
-			arguments[i + inputs].PointerVal = (llvm::PointerTy)&outs[i];
-
-		llvm::GenericValue ret = JIT::GetSingleton().GetExecutionEngine()->runFunction(function, arguments);
-
-		// push outs
-		for(size_t i = 0; i < real_outputs; i++)
-			e.runtime_stack.push_back(outs[i]);
-		
-		const llvm::FunctionType *ftype = function->getFunctionType();
-		if(ftype->getReturnType() != llvm::Type::VoidTy)
-			e.runtime_stack.push_back((int)ret.PointerVal);	
+		// call in place over the data stack
+		cell *cells = e.runtime_stack.Enter(inputs, outputs);
+		entry(native, cells);
+		e.runtime_stack.Leave(inputs, outputs);
 	}
 	else
 	{
+		JIT &jit = JIT::GetSingleton();
+		const llvm::FunctionType *ftype = function->getFunctionType();
+
 		// setup inputs
-		std::vector<llvm::Value *> arguments(inputs + real_outputs);
+		size_t pointer_outputs = ftype->getNumParams() - inputs;
+		std::vector<llvm::Value *> arguments(inputs + pointer_outputs);
 		for(size_t i = 0; i < inputs; i++)
 		{
-			WordIndex *input = e.Pop();
+			WordIndex *input = e.Pop(ftype->getParamType(i));
 			arguments[i] = input->GetOutput();
 		}
 
-		// setup outputs
-		for(size_t i = 0; i < real_outputs; i++)
+		// primitives are cloned into the caller
+		if(inlined)
+		{
+			llvm::Value *ret = jit.InlineCall(function, arguments);
+			if(llvm::isa<llvm::StructType>(ftype->getReturnType()))
+				for(size_t i = 0; i < outputs; i++)
+					instance->SetOutput(i, jit.GetBuilder()->CreateExtractValue(ret, i));
+			else if(ret != NULL)
+				instance->SetOutput(0, ret);
+			return;
+		}
+
+		// externs with several outputs use the c abi pointers
+		for(size_t i = 0; i < pointer_outputs; i++)
+			arguments[i + inputs] = jit.CreateEntryAlloca(llvm::cast<llvm::PointerType>(ftype->getParamType(i + inputs))->getElementType());
+
+		// live words are called through their slot
+		llvm::Value *callee = function;
+		if(slot != NULL)
 		{
-			llvm::Value *value = JIT::GetSingleton().GetBuilder()->CreateAlloca(llvm::Type::Int32Ty);
-			arguments[i + inputs] = value;
-			instance->SetOutput(i, value);
+			callee = jit.GetBuilder()->CreateLoad(slot);
+			e.UseWord(this);
 		}
 
 		// append call
-		JIT::GetSingleton().GetBuilder()->CreateCall<std::vector<llvm::Value *>::iterator>(function, arguments.begin(), arguments.end());
+		llvm::CallInst *call = jit.GetBuilder()->CreateCall<std::vector<llvm::Value *>::iterator>(callee, arguments.begin(), arguments.end());
+		call->setCallingConv(function->getCallingConv());
 
 		// finish outputs
-		for(size_t i = 0; i < real_outputs; i++)
+		size_t index = 0;
+		for(size_t i = 0; i < pointer_outputs; i++)
+			instance->SetOutput(index++, jit.GetBuilder()->CreateLoad(arguments[i + inputs]));
+
+		const llvm::Type *ret_type = ftype->getReturnType();
+		if(const llvm::StructType *stype = llvm::dyn_cast<llvm::StructType>(ret_type))
 		{
-			llvm::Value *output = instance->GetOutput(i);
-			output = JIT::GetSingleton().GetBuilder()->CreateLoad(output);
-			instance->SetOutput(i, output);
+			for(unsigned i = 0; i < stype->getNumElements(); i++)
+				instance->SetOutput(index++, jit.GetBuilder()->CreateExtractValue(call, i));
 		}
+		else if(ret_type != llvm::Type::VoidTy)
+			instance->SetOutput(index++, call);
 	}
 }
 
 void LiteralWord::Execute(WordInstance *instance)
 {
 	if(instance == NULL)
-		Engine::GetSingleton().runtime_stack.push_front(number);
+		Engine::GetSingleton().runtime_stack.Push(number);
 	else
 	{
-		llvm::Value *output = llvm::ConstantInt::get(llvm::APInt(32, number));
+		llvm::Value *output = llvm::ConstantInt::get(JIT::GetSingleton().GetCellType(), number, true);
 		instance->SetOutput(0, output);
 	}
 }
 
+void FloatWord::Execute(WordInstance *instance)
+{
+	if(instance == NULL)
+		Engine::GetSingleton().runtime_stack.Push(FloatToCell(number));
+	else
+		instance->SetOutput(0, llvm::ConstantFP::get(llvm::APFloat(number)));
+}
+
 void ArgumentWord::Execute(WordInstance *instance)
 {
 	assert(instance != NULL);
-	llvm::Value *output = JIT::GetSingleton().CreateInputArgument();
+	llvm::Value *output = JIT::GetSingleton().CreateInputArgument(type);
 	instance->SetOutput(0, output);
 }
 
+ShuffleWord::ShuffleWord(const std::string &_name, const std::string &shuffle) : name(_name)
+{
+	size_t separator = shuffle.find('-');
+	assert(separator != std::string::npos && separator <= 8);
+	inputs = shuffle.substr(0, separator);
+	outputs = shuffle.substr(separator + 1);
+}
+
+bool ShuffleWord::GetStackEffect(size_t &inputs, size_t &outputs)
+{
+	inputs = this->inputs.size();
+	outputs = this->outputs.size();
+	return true;
+}
+
+void ShuffleWord::Execute(WordInstance *instance)
+{
+	Engine &e = Engine::GetSingleton();
+	size_t size = inputs.size();
+
+	if(instance == NULL)
+	{
+		// permute the cells in place
+		cell values[8];
+		cell *cells = e.runtime_stack.Enter(size, outputs.size());
+		for(size_t i = 0; i < size; i++)
+			values[i] = cells[i];
+		for(size_t i = 0; i < outputs.size(); i++)
+			cells[i] = values[outputs[i] - 'a'];
+		e.runtime_stack.Leave(size, outputs.size());
+	}
+	else
+	{
+		// only the compile time stack changes, the last input is the top
+		llvm::Value *values[8];
+		for(size_t i = size; i > 0; i--)
+			values[i - 1] = e.Pop()->GetOutput();
+		for(size_t i = 0; i < outputs.size(); i++)
+			instance->SetOutput(i, values[outputs[i] - 'a']);
+	}
+}
+
+void ValueWord::Execute(WordInstance *instance)
+{
+	assert(instance != NULL);
+	instance->SetOutput(0, value);
+}
+
+void ControlWord::Execute(WordInstance *instance)
+{
+	Engine &e = Engine::GetSingleton();
+	if(!e.IsCompiling())
+		throw name + " is compile only";
+	(e.*method)();
+}
+
+void VariableWord::Execute(WordInstance *instance)
+{
+	if(instance == NULL)
+	{
+		void *address = JIT::GetSingleton().GetExecutionEngine()->getPointerToGlobal(variable);
+		Engine::GetSingleton().runtime_stack.Push((cell)(intptr_t)address);
+	}
+	else
+		instance->SetOutput(0, llvm::ConstantExpr::getPtrToInt(variable, JIT::GetSingleton().GetCellType()));
+}
+
 void StringWord::Execute(WordInstance *instance)
 {
 	assert(instance != NULL);
 
 	std::string string = Engine::GetSingleton().GetLexer()->ReadUntil('"');
 
+	// set string pointer, the same text is the same global
+	llvm::GlobalVariable *string_gv = JIT::GetSingleton().InternString(string);
+	llvm::Value *ptr_to_int = JIT::GetSingleton().GetBuilder()->CreatePtrToInt(string_gv, JIT::GetSingleton().GetCellType());
+	instance->SetOutput(0, ptr_to_int);
+
 	// set string size
-	llvm::Value *size = llvm::ConstantInt::get(llvm::APInt(32, string.size()));
-	instance->SetOutput(0, size);
-
-	// set string pointer
-	llvm::Constant *string_constant = llvm::ConstantArray::get(string.c_str(), true);
-	llvm::GlobalVariable *string_gv = new llvm::GlobalVariable(string_constant->getType(), true, llvm::GlobalValue::InternalLinkage, string_constant, "", JIT::GetSingleton().GetModule(), false);
-	llvm::Value *ptr_to_int = JIT::GetSingleton().GetBuilder()->CreatePtrToInt(string_gv, llvm::Type::Int32Ty);
-	instance->SetOutput(1, ptr_to_int);
+	llvm::Value *size = llvm::ConstantInt::get(JIT::GetSingleton().GetCellType(), string.size());
+	instance->SetOutput(1, size);
+}
+
+bool StringFoldWord::GetStackEffect(size_t &inputs, size_t &outputs)
+{
+	return runtime->GetStackEffect(inputs, outputs);
+}
+
+void StringFoldWord::Execute(WordInstance *instance)
+{
+	Engine &e = Engine::GetSingleton();
+	JIT &jit = JIT::GetSingleton();
+	if(instance == NULL)
+	{
+		runtime->Execute(NULL);
+		return;
+	}
+
+	// ( a1 u1 a2 u2 ), two literals fold, anything else is a call
+	std::vector<WordIndex *> &stack = e.compiler_stack;
+	std::string first, second;
+	size_t size = stack.size();
+	if(size < 4
+		|| !jit.GetStringLiteral(stack[size - 4]->GetOutput(), stack[size - 3]->GetOutput(), first)
+		|| !jit.GetStringLiteral(stack[size - 2]->GetOutput(), stack[size - 1]->GetOutput(), second))
+	{
+		runtime->Execute(instance);
+		return;
+	}
+	for(int i = 0; i < 4; i++)
+		e.Pop();
+
+	const llvm::Type *cell_type = jit.GetCellType();
+	if(op == COMPARE)
+	{
+		int order = first.compare(second);
+		instance->SetOutput(0, llvm::ConstantInt::get(cell_type, order < 0 ? -1 : order > 0 ? 1 : 0, true));
+	}
+	else
+	{
+		std::string text = first + second;
+		instance->SetOutput(0, jit.GetBuilder()->CreatePtrToInt(jit.InternString(text), cell_type));
+		instance->SetOutput(1, llvm::ConstantInt::get(cell_type, text.size()));
+	}
 }
 
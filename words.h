@@ -1,48 +1,146 @@
 #pragma once
 
+#include <vector>
+#include <llvm/GlobalVariable.h>
 #include "word.h"
+#include "stack.h"
+#include "threaded.h"
 
 class FunctionWord : public Word
 {
 	llvm::Function *function;
+	ThreadedCode *threaded;
+	void *native;
+	void (*entry)(void *function, cell *cells);
+	const char *name;
 	size_t inputs;
 	size_t outputs;
+	bool inlined;
+	uint64_t source_key;
+
+	// live mode, callers go through the slot and are recompiled from
+	// source when a redefinition changes the stack effect
+	llvm::GlobalVariable *slot;
+	const char *source;
+	std::vector<FunctionWord *> users;
 public:
 	FunctionWord();
 
-	std::string GetName() { return function->getName(); }
+	std::string GetName() { return name; }
+	void SetName(const char *name) { this->name = name; }
 	llvm::Function *GetFunction() { return function; }
-	void SetFunction(llvm::Function* function) { this->function = function; }
+	void SetFunction(llvm::Function* function) { this->function = function; this->entry = NULL; }
 	size_t GetInputSize() { return inputs; }
 	void SetInputSize(size_t inputs) { this->inputs = inputs; }
 	size_t GetOutputSize() { return outputs; }
 	void SetOutputSize(size_t outputs) { this->outputs = outputs; }
+	ThreadedCode *GetThreaded() { return threaded; }
+	void SetThreaded(ThreadedCode *threaded) { this->threaded = threaded; }
+	bool IsInline() { return inlined; }
+	void SetInline(bool inlined) { this->inlined = inlined; }
+	uint64_t GetSourceKey() { return source_key; }
+	void SetSourceKey(uint64_t key) { source_key = key; }
+	llvm::GlobalVariable *GetSlot() { return slot; }
+	void SetSlot(llvm::GlobalVariable *slot) { this->slot = slot; }
+	const char *GetSource() { return source; }
+	void SetSource(const char *source) { this->source = source; }
+	std::vector<FunctionWord *> &GetUsers() { return users; }
+	void AddUser(FunctionWord *user);
+
+	bool IsBatchable() { return threaded == NULL && Word::IsBatchable(); }
+	bool GetStackEffect(size_t &inputs, size_t &outputs);
 
 	void Execute(WordInstance *instance);
 };
 
 class LiteralWord : public Word
 {
-	int number;
+	cell number;
 public:
-	LiteralWord(int _number) : number(_number) { }
+	LiteralWord(cell _number) : number(_number) { }
 
 	std::string GetName() { return "lit"; }
 
 	void Execute(WordInstance *instance);
 };
 
+class FloatWord : public Word
+{
+	double number;
+public:
+	FloatWord(double _number) : number(_number) { }
+
+	std::string GetName() { return "flit"; }
+
+	void Execute(WordInstance *instance);
+};
+
 class ArgumentWord : public Word
 {
 	int number;
+	const llvm::Type *type;
 public:
-	ArgumentWord(int _number) : number(_number) { }
+	ArgumentWord(int _number, const llvm::Type *_type) : number(_number), type(_type) { }
 
 	std::string GetName() { return "arg"; }
 
 	void Execute(WordInstance *instance);
 };
 
+// stack permutation like "abc-bca", compiles to no code
+class ShuffleWord : public Word
+{
+	std::string name;
+	std::string inputs;
+	std::string outputs;
+public:
+	ShuffleWord(const std::string &_name, const std::string &shuffle);
+
+	std::string GetName() { return name; }
+	bool GetStackEffect(size_t &inputs, size_t &outputs);
+
+	void Execute(WordInstance *instance);
+};
+
+// value already in the function, like a phi at a join point
+class ValueWord : public Word
+{
+	llvm::Value *value;
+public:
+	ValueWord(llvm::Value *_value) : value(_value) { }
+
+	std::string GetName() { return "value"; }
+
+	void Execute(WordInstance *instance);
+};
+
+// immediate word that shapes the control flow of the current definition
+class ControlWord : public Word
+{
+	std::string name;
+	void (Engine::*method)();
+public:
+	ControlWord(const std::string &_name, void (Engine::*_method)()) : name(_name), method(_method) { SetImmediate(true); }
+
+	std::string GetName() { return name; }
+
+	void Execute(WordInstance *instance);
+};
+
+// address of a cell of its own in the data space
+class VariableWord : public Word
+{
+	std::string name;
+	llvm::GlobalVariable *variable;
+public:
+	VariableWord(const std::string &_name, llvm::GlobalVariable *_variable) : name(_name), variable(_variable) { }
+
+	std::string GetName() { return name; }
+	bool GetStackEffect(size_t &inputs, size_t &outputs) { inputs = 0; outputs = 1; return true; }
+
+	void Execute(WordInstance *instance);
+};
+
 class StringWord : public Word
 {
 public:
@@ -51,3 +149,22 @@ public:
 	void Execute(WordInstance *instance);
 };
 
+// string words over literals fold into constants, the runtime word
+// does the rest
+class StringFoldWord : public Word
+{
+public:
+	enum Op { COMPARE, CONCAT };
+private:
+	std::string name;
+	Op op;
+	FunctionWord *runtime;
+public:
+	StringFoldWord(const std::string &_name, Op _op, FunctionWord *_runtime) : name(_name), op(_op), runtime(_runtime) { }
+
+	std::string GetName() { return name; }
+	bool GetStackEffect(size_t &inputs, size_t &outputs);
+
+	void Execute(WordInstance *instance);
+};
+